@@ -0,0 +1,501 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mark_and_sweep.hpp"
+#include "snapshot.hpp"
+
+// Micro-benchmarks of gc::MarkAndSweep.
+//
+// usage: bench [--filter SUBSTRING] [--repeat N] [--out FILE]
+//
+// Every benchmark is run --repeat times with the same seed and the median of
+// each metric is reported. Results are written as JSON (to stdout by default).
+
+using bench_clock = std::chrono::steady_clock;
+
+const size_t KiB = 1024;
+const size_t MiB = 1024 * KiB;
+const size_t GiB = 1024 * MiB;
+
+// object layout used by all benchmarks (header is skipped by the marker)
+struct Object {
+  size_t header;
+  Object *fields[];
+};
+
+size_t object_size(size_t n_fields) {
+  return sizeof(Object) + n_fields * sizeof(Object *);
+}
+
+double seconds(bench_clock::time_point from, bench_clock::time_point to) {
+  return std::chrono::duration<double>(to - from).count();
+}
+
+struct Result {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> params;
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+class Runner {
+public:
+  std::string filter;
+  size_t repeat = 5;
+
+  using Params = std::vector<std::pair<std::string, std::string>>;
+  using Metrics = std::vector<std::pair<std::string, double>>;
+
+  void run(const std::string &name, const Params &params,
+           const std::function<Metrics()> &bench) {
+    auto full_name = name;
+    for (auto &[k, v] : params) {
+      full_name += "/" + k + "=" + v;
+    }
+    if (full_name.find(filter) == std::string::npos) {
+      return;
+    }
+    std::cerr << full_name << std::endl;
+    std::vector<Metrics> runs;
+    for (size_t i = 0; i < repeat; i++) {
+      runs.push_back(bench());
+    }
+    Result result{.name = name, .params = params, .metrics = {}};
+    for (size_t m = 0; m < runs[0].size(); m++) {
+      std::vector<double> values;
+      for (auto &run : runs) {
+        values.push_back(run[m].second);
+      }
+      std::sort(values.begin(), values.end());
+      result.metrics.emplace_back(runs[0][m].first, values[values.size() / 2]);
+    }
+    results.push_back(result);
+  }
+
+  // throws std::domain_error on metrics JSON can't represent (nan, inf)
+  void write_json(std::ostream &out) const {
+    for (auto &result : results) {
+      for (auto &[metric, value] : result.metrics) {
+        if (!std::isfinite(value)) {
+          throw std::domain_error(std::format("{}: {} is {}", result.name,
+                                              metric, value));
+        }
+      }
+    }
+    out << "{\n";
+    out << "  \"build\": {\n";
+    out << "    \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "    \"date\": \"" << __DATE__ << " " << __TIME__ << "\",\n";
+    out << "    \"repeat\": " << repeat << "\n";
+    out << "  },\n";
+    out << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+      auto &result = results[i];
+      out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+          << "\", \"params\": {";
+      for (size_t j = 0; j < result.params.size(); j++) {
+        out << (j ? ", " : "") << "\"" << result.params[j].first << "\": \""
+            << result.params[j].second << "\"";
+      }
+      out << "}, \"metrics\": {";
+      for (size_t j = 0; j < result.metrics.size(); j++) {
+        out << (j ? ", " : "") << "\"" << result.metrics[j].first
+            << "\": " << result.metrics[j].second;
+      }
+      out << "}}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  std::vector<Result> results;
+};
+
+std::string on_off(bool flag) { return flag ? "on" : "off"; }
+
+// Build a random object graph of about `live_bytes` bytes reachable from
+// `root` (each object points to the previous one and to a random earlier
+// object), in a collector.
+void build_live_set(gc::MarkAndSweep &collector, Object *&root,
+                    size_t live_bytes, std::mt19937 &gen) {
+  std::uniform_int_distribution<size_t> fields_distr(1, 4);
+  std::vector<Object *> objects;
+  size_t bytes = 0;
+  while (bytes < live_bytes) {
+    auto n_fields = fields_distr(gen);
+    auto obj =
+        reinterpret_cast<Object *>(collector.allocate(object_size(n_fields)));
+    if (!obj) {
+      break;
+    }
+    obj->header = n_fields;
+    std::memset(obj->fields, 0, n_fields * sizeof(Object *));
+    obj->fields[0] = root;
+    if (n_fields > 1 && !objects.empty()) {
+      std::uniform_int_distribution<size_t> target(0, objects.size() - 1);
+      obj->fields[1] = objects[target(gen)];
+    }
+    root = obj;
+    objects.push_back(obj);
+    bytes += object_size(n_fields);
+  }
+}
+
+// Allocate garbage until the heap is full.
+size_t fill_with_garbage(gc::MarkAndSweep &collector, size_t n_fields) {
+  size_t n = 0;
+  while (auto obj = reinterpret_cast<Object *>(
+             collector.allocate(object_size(n_fields)))) {
+    obj->header = 0;
+    std::memset(obj->fields, 0, n_fields * sizeof(Object *));
+    n++;
+  }
+  return n;
+}
+
+void bench_allocation(Runner &runner) {
+  struct Mix {
+    std::string name;
+    size_t min_fields;
+    size_t max_fields;
+  };
+  std::vector<Mix> mixes = {
+      {"small", 1, 1}, {"mixed", 0, 8}, {"large", 16, 64}};
+  for (auto &mix : mixes) {
+    for (bool merge : {false, true}) {
+      runner.run(
+          "allocation", {{"mix", mix.name}, {"merge_blocks", on_off(merge)}},
+          [&]() -> Runner::Metrics {
+            const size_t heap = 2 * MiB;
+            const size_t rounds = 4;
+            gc::MarkAndSweep collector(heap, merge, true, false);
+            std::mt19937 gen(42);
+            std::uniform_int_distribution<size_t> fields_distr(mix.min_fields,
+                                                               mix.max_fields);
+            size_t n = 0;
+            size_t bytes = 0;
+            double alloc_time = 0;
+            for (size_t r = 0; r < rounds; r++) {
+              auto start = bench_clock::now();
+              while (true) {
+                auto size = object_size(fields_distr(gen));
+                auto obj = collector.allocate(size);
+                if (!obj) {
+                  break;
+                }
+                n++;
+                bytes += size;
+              }
+              alloc_time += seconds(start, bench_clock::now());
+              collector.collect();
+            }
+            return {{"allocations_per_second", n / alloc_time},
+                    {"bytes_per_second", bytes / alloc_time},
+                    {"ns_per_allocation", 1e9 * alloc_time / n}};
+          });
+    }
+  }
+}
+
+void bench_collect(Runner &runner) {
+  for (size_t heap : {1 * MiB, 16 * MiB, 64 * MiB}) {
+    for (double live : {0.1, 0.5, 0.9}) {
+      runner.run("collect",
+                 {{"heap_bytes", std::to_string(heap)},
+                  {"live_fraction", std::format("{}", live)}},
+                 [&]() -> Runner::Metrics {
+                   gc::MarkAndSweep collector(heap, true, true, false);
+                   std::mt19937 gen(42);
+                   Object *root = nullptr;
+                   collector.push_root(reinterpret_cast<void **>(&root));
+                   build_live_set(collector, root, heap * live, gen);
+                   fill_with_garbage(collector, 2);
+                   auto stats = collector.get_stats();
+                   auto start = bench_clock::now();
+                   collector.collect();
+                   auto time = seconds(start, bench_clock::now());
+                   auto after = collector.get_stats();
+                   return {{"collect_ms", 1e3 * time},
+                           {"mark_ms", 1e-6 * after.mark_ns},
+                           {"sweep_ms", 1e-6 * after.sweep_ns},
+                           {"live_bytes", 1.0 * after.bytes_used},
+                           {"blocks_before", 1.0 * stats.n_blocks_used}};
+                 });
+    }
+  }
+}
+
+void bench_incremental(Runner &runner) {
+  for (double live : {0.1, 0.5}) {
+    runner.run(
+        "incremental_step", {{"live_fraction", std::format("{}", live)}},
+        [&]() -> Runner::Metrics {
+          const size_t heap = 1 * MiB;
+          const size_t allocations = 200'000;
+          gc::MarkAndSweep collector(heap, true, true, true);
+          std::mt19937 gen(42);
+          Object *root = nullptr;
+          collector.push_root(reinterpret_cast<void **>(&root));
+          build_live_set(collector, root, heap * live, gen);
+          auto start = bench_clock::now();
+          for (size_t i = 0; i < allocations; i++) {
+            auto obj =
+                reinterpret_cast<Object *>(collector.allocate(object_size(2)));
+            if (!obj) {
+              break;
+            }
+            obj->header = 2;
+            obj->fields[0] = nullptr;
+            obj->fields[1] = nullptr;
+          }
+          auto time = seconds(start, bench_clock::now());
+          auto stats = collector.get_stats();
+          auto &pauses = stats.incremental_pauses;
+          return {
+              {"ns_per_allocation", 1e9 * time / allocations},
+              {"step_p50_ns", 1.0 * pauses.percentile(0.5)},
+              {"step_p99_ns", 1.0 * pauses.percentile(0.99)},
+              {"step_max_ns", 1.0 * pauses.max_ns},
+              {"cycles", 1.0 * stats.incremental_collections},
+              {"mmu_1ms", stats.mmu[0]},
+          };
+        });
+  }
+}
+
+void bench_barriers(Runner &runner) {
+  for (bool incremental : {false, true}) {
+    runner.run(
+        "barriers", {{"incremental", on_off(incremental)}},
+        [&]() -> Runner::Metrics {
+          const size_t heap = 1 * MiB;
+          const size_t ops = 10'000'000;
+          gc::MarkAndSweep collector(heap, true, true, incremental);
+          std::mt19937 gen(42);
+          Object *root = nullptr;
+          collector.push_root(reinterpret_cast<void **>(&root));
+          build_live_set(collector, root, heap / 4, gen);
+          std::vector<Object *> objects;
+          for (auto obj = root; obj; obj = obj->fields[0]) {
+            objects.push_back(obj);
+          }
+          std::uniform_int_distribution<size_t> distr(0, objects.size() - 1);
+          std::vector<std::pair<Object *, Object *>> pairs;
+          for (size_t i = 0; i < 1024; i++) {
+            pairs.emplace_back(objects[distr(gen)], objects[distr(gen)]);
+          }
+          auto start = bench_clock::now();
+          for (size_t i = 0; i < ops; i++) {
+            collector.read(pairs[i % pairs.size()].first);
+          }
+          auto read_time = seconds(start, bench_clock::now());
+          start = bench_clock::now();
+          for (size_t i = 0; i < ops; i++) {
+            auto &[obj, contents] = pairs[i % pairs.size()];
+            collector.write(obj, contents);
+          }
+          auto write_time = seconds(start, bench_clock::now());
+          return {{"read_barrier_ns", 1e9 * read_time / ops},
+                  {"write_barrier_ns", 1e9 * write_time / ops}};
+        });
+  }
+}
+
+void bench_fragmentation(Runner &runner) {
+  for (bool merge : {false, true}) {
+    runner.run(
+        "fragmentation", {{"merge_blocks", on_off(merge)}},
+        [&]() -> Runner::Metrics {
+          const size_t heap = 1 * MiB;
+          const size_t cycles = 20;
+          const size_t n_roots = 256;
+          gc::MarkAndSweep collector(heap, merge, true, false);
+          std::mt19937 gen(42);
+          std::uniform_int_distribution<size_t> fields_distr(0, 16);
+          std::uniform_int_distribution<size_t> root_distr(0, n_roots - 1);
+          std::vector<Object *> roots(n_roots, nullptr);
+          for (auto &root : roots) {
+            collector.push_root(reinterpret_cast<void **>(&root));
+          }
+          // churn: random sizes, a random subset survives every cycle
+          for (size_t c = 0; c < cycles; c++) {
+            while (true) {
+              auto n_fields = fields_distr(gen);
+              auto obj = reinterpret_cast<Object *>(
+                  collector.allocate(object_size(n_fields)));
+              if (!obj) {
+                break;
+              }
+              obj->header = n_fields;
+              std::memset(obj->fields, 0, n_fields * sizeof(Object *));
+              roots[root_distr(gen)] = obj;
+            }
+            collector.collect();
+          }
+          std::ostringstream out;
+          collector.write_snapshot(out);
+          auto data = out.str();
+          gc::Snapshot snapshot(
+              {reinterpret_cast<const unsigned char *>(data.data()),
+               data.size()});
+          auto summary = snapshot.summary();
+          auto stats = collector.get_stats();
+          return {
+              {"bytes_free", 1.0 * summary.bytes_free},
+              {"free_blocks", 1.0 * summary.n_blocks_free},
+              {"largest_free_block", 1.0 * summary.largest_free_block},
+              // no free memory is not fragmented
+              {"fragmentation",
+               summary.bytes_free == 0
+                   ? 0.0
+                   : 1.0 - 1.0 * summary.largest_free_block /
+                               summary.bytes_free},
+              {"collections", 1.0 * stats.collections},
+          };
+        });
+  }
+}
+
+// Huge pages only pay off when the heap is much larger than what the TLB
+// covers with regular pages, hence heaps of several GiB.
+void bench_huge_pages(Runner &runner) {
+  std::vector<std::pair<std::string, gc::HugePages>> modes = {
+      {"none", gc::HugePages::NONE},
+      {"transparent", gc::HugePages::TRANSPARENT},
+      {"explicit", gc::HugePages::EXPLICIT}};
+  for (size_t heap : {1 * GiB, 4 * GiB}) {
+    for (auto &[mode, huge_pages] : modes) {
+      runner.run(
+          "huge_pages",
+          {{"heap_bytes", std::to_string(heap)}, {"huge_pages", mode}},
+          [&]() -> Runner::Metrics {
+            gc::MarkAndSweep collector(heap, true, true, false, huge_pages);
+            std::mt19937 gen(42);
+            Object *root = nullptr;
+            collector.push_root(reinterpret_cast<void **>(&root));
+            build_live_set(collector, root, heap / 4, gen);
+            auto start = bench_clock::now();
+            auto n = fill_with_garbage(collector, 2);
+            auto alloc_time = seconds(start, bench_clock::now());
+            start = bench_clock::now();
+            collector.collect();
+            auto time = seconds(start, bench_clock::now());
+            auto stats = collector.get_stats();
+            // backing actually used: 0 = none, 1 = transparent, 2 = explicit
+            auto backing = static_cast<int>(collector.huge_pages());
+            return {{"bytes_per_second", n * object_size(2) / alloc_time},
+                    {"collect_ms", 1e3 * time},
+                    {"mark_ms", 1e-6 * stats.mark_ns},
+                    {"sweep_ms", 1e-6 * stats.sweep_ns},
+                    {"backing", 1.0 * backing}};
+          });
+    }
+  }
+}
+
+// Build a complete binary tree of about `live_bytes` bytes (children are
+// allocated before their parent).
+Object *build_tree(gc::MarkAndSweep &collector, size_t live_bytes) {
+  std::function<Object *(size_t)> build = [&](size_t n) -> Object * {
+    if (n == 0) {
+      return nullptr;
+    }
+    auto left = build((n - 1) / 2);
+    auto right = build(n - 1 - (n - 1) / 2);
+    auto obj = reinterpret_cast<Object *>(collector.allocate(object_size(2)));
+    obj->header = 2;
+    obj->fields[0] = left;
+    obj->fields[1] = right;
+    return obj;
+  };
+  return build(live_bytes / (object_size(2) + sizeof(size_t)));
+}
+
+void bench_mark_strategy(Runner &runner) {
+  struct Strategy {
+    std::string name;
+    gc::MarkStrategy strategy;
+    size_t max_stack;
+  };
+  std::vector<Strategy> strategies = {
+      {"pointer_reversal", gc::MarkStrategy::POINTER_REVERSAL,
+       gc::MarkAndSweep::default_max_mark_stack},
+      {"mark_stack", gc::MarkStrategy::MARK_STACK,
+       gc::MarkAndSweep::default_max_mark_stack},
+      // overflows all the time
+      {"mark_stack_64", gc::MarkStrategy::MARK_STACK, 64}};
+  const size_t heap = 64 * MiB;
+  for (std::string shape : {"graph", "tree"}) {
+    for (auto &strategy : strategies) {
+      runner.run(
+          "mark_strategy",
+          {{"shape", shape}, {"strategy", strategy.name}},
+          [&]() -> Runner::Metrics {
+            gc::MarkAndSweep collector(heap, true, true, false);
+            collector.set_mark_strategy(strategy.strategy, strategy.max_stack);
+            std::mt19937 gen(42);
+            Object *root = nullptr;
+            collector.push_root(reinterpret_cast<void **>(&root));
+            if (shape == "graph") {
+              build_live_set(collector, root, heap / 2, gen);
+            } else {
+              root = build_tree(collector, heap / 2);
+            }
+            // marking only, nothing to sweep
+            collector.collect();
+            auto stats = collector.get_stats();
+            return {{"mark_ms", 1e-6 * stats.mark_ns},
+                    {"live_bytes", 1.0 * stats.bytes_used}};
+          });
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  Runner runner;
+  std::string out_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) {
+      runner.filter = argv[++i];
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      runner.repeat = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--filter SUBSTRING] [--repeat N] [--out FILE]"
+                << std::endl;
+      return 2;
+    }
+  }
+  bench_allocation(runner);
+  bench_collect(runner);
+  bench_incremental(runner);
+  bench_barriers(runner);
+  bench_fragmentation(runner);
+  bench_huge_pages(runner);
+  bench_mark_strategy(runner);
+  try {
+    if (out_path.empty()) {
+      runner.write_json(std::cout);
+    } else {
+      std::ofstream out(out_path);
+      runner.write_json(out);
+    }
+  } catch (const std::domain_error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "runtime.h"
+#include "workloads.h"
+
+/*
+ * fn build(n : Nat) -> [Nat] {
+ *   return Nat::rec(n, [], fn(i : Nat) { return fn(acc : [Nat]) { return cons(i, acc) } })
+ * }
+ * fn map_succ(xs : [Nat]) -> [Nat] {
+ *   return match xs { [] => [] | cons(x, rest) => cons(succ(x), map_succ(rest)) }
+ * }
+ * fn length(xs : [Nat]) -> Nat {
+ *   return match xs { [] => 0 | cons(_, rest) => succ(length(rest)) }
+ * }
+ * fn main(n : Nat) -> Nat { return length(map_succ(build(n))) }
+ */
+
+static stella_object *cons_i(stella_object *closure, stella_object *acc) {
+  stella_object *res;
+  gc_push_root((void**)&closure);
+  gc_push_root((void**)&acc);
+  res = alloc_stella_object(TAG_CONS, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, STELLA_OBJECT_READ_FIELD(closure, 1));
+  STELLA_OBJECT_INIT_FIELD(res, 1, acc);
+  gc_pop_root((void**)&acc);
+  gc_pop_root((void**)&closure);
+  return res;
+}
+
+static stella_object *build_step(stella_object *closure, stella_object *i) {
+  stella_object *res;
+  gc_push_root((void**)&i);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &cons_i);
+  STELLA_OBJECT_INIT_FIELD(res, 1, i);
+  gc_pop_root((void**)&i);
+  return res;
+}
+
+static stella_object_1 the_build_step = { .object_header = TAG_FN | 1 << 4, .object_fields = { &build_step } };
+
+static stella_object *build(stella_object *closure, stella_object *n) {
+  return stella_object_nat_rec(n, &the_EMPTY, (stella_object*)&the_build_step);
+}
+
+static stella_object_1 the_build = { .object_header = TAG_FN | 1 << 4, .object_fields = { &build } };
+static stella_object *const build_closure = (stella_object*)&the_build;
+
+static stella_object *map_succ(stella_object *closure, stella_object *xs) {
+  stella_object *x = NULL, *rest = NULL, *res;
+  if (STELLA_OBJECT_HEADER_TAG(xs->object_header) == TAG_EMPTY) {
+    return &the_EMPTY;
+  }
+  gc_push_root((void**)&xs);
+  gc_push_root((void**)&x);
+  gc_push_root((void**)&rest);
+  x = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(x, 0, STELLA_OBJECT_READ_FIELD(xs, 0));
+  rest = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_READ_FIELD(xs, 1));
+  res = alloc_stella_object(TAG_CONS, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, x);
+  STELLA_OBJECT_INIT_FIELD(res, 1, rest);
+  gc_pop_root((void**)&rest);
+  gc_pop_root((void**)&x);
+  gc_pop_root((void**)&xs);
+  return res;
+}
+
+static stella_object_1 the_map_succ = { .object_header = TAG_FN | 1 << 4, .object_fields = { &map_succ } };
+static stella_object *const map_succ_closure = (stella_object*)&the_map_succ;
+
+static stella_object *length(stella_object *closure, stella_object *xs) {
+  stella_object *n, *res;
+  if (STELLA_OBJECT_HEADER_TAG(xs->object_header) == TAG_EMPTY) {
+    return &the_ZERO;
+  }
+  n = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_READ_FIELD(xs, 1));
+  gc_push_root((void**)&n);
+  res = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(res, 0, n);
+  gc_pop_root((void**)&n);
+  return res;
+}
+
+static stella_object_1 the_length = { .object_header = TAG_FN | 1 << 4, .object_fields = { &length } };
+static stella_object *const length_closure = (stella_object*)&the_length;
+
+static stella_object *list_fold_main(stella_object *closure, stella_object *n) {
+  stella_object *xs;
+  xs = STELLA_OBJECT_CLOSURE_CALL(build_closure, n);
+  xs = STELLA_OBJECT_CLOSURE_CALL(map_succ_closure, xs);
+  return STELLA_OBJECT_CLOSURE_CALL(length_closure, xs);
+}
+
+static stella_object_1 the_list_fold_main = { .object_header = TAG_FN | 1 << 4, .object_fields = { &list_fold_main } };
+
+const stella_workload list_fold_workload = {
+  .name = "list_fold",
+  .input = 20000,
+  .expected = 20000,
+  .main_closure = (stella_object*)&the_list_fold_main,
+};
@@ -0,0 +1,110 @@
+#include "runtime.h"
+#include "workloads.h"
+
+/*
+ * fn add(m : Nat) -> (fn(Nat) -> Nat) {
+ *   return fn(n : Nat) { return Nat::rec(m, n, fn(_ : Nat) { return fn(acc : Nat) { return succ(acc) } }) }
+ * }
+ * fn mul(m : Nat) -> (fn(Nat) -> Nat) {
+ *   return fn(k : Nat) { return Nat::rec(m, 0, fn(_ : Nat) { return fn(acc : Nat) { return add(acc)(k) } }) }
+ * }
+ * fn main(n : Nat) -> Nat { return mul(n)(n) }
+ *
+ * add(acc)(k) copies acc on every step, so all intermediate sums become garbage.
+ */
+
+static stella_object *succ_acc(stella_object *closure, stella_object *acc) {
+  stella_object *res;
+  gc_push_root((void**)&acc);
+  res = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(res, 0, acc);
+  gc_pop_root((void**)&acc);
+  return res;
+}
+
+static stella_object_1 the_succ_acc = { .object_header = TAG_FN | 1 << 4, .object_fields = { &succ_acc } };
+
+static stella_object *succ_step(stella_object *closure, stella_object *i) {
+  return (stella_object*)&the_succ_acc;
+}
+
+static stella_object_1 the_succ_step = { .object_header = TAG_FN | 1 << 4, .object_fields = { &succ_step } };
+
+static stella_object *add_m(stella_object *closure, stella_object *n) {
+  return stella_object_nat_rec(STELLA_OBJECT_READ_FIELD(closure, 1), n, (stella_object*)&the_succ_step);
+}
+
+static stella_object *add(stella_object *closure, stella_object *m) {
+  stella_object *res;
+  gc_push_root((void**)&m);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &add_m);
+  STELLA_OBJECT_INIT_FIELD(res, 1, m);
+  gc_pop_root((void**)&m);
+  return res;
+}
+
+static stella_object_1 the_add = { .object_header = TAG_FN | 1 << 4, .object_fields = { &add } };
+static stella_object *const add_closure = (stella_object*)&the_add;
+
+static stella_object *add_k(stella_object *closure, stella_object *acc) {
+  stella_object *f;
+  gc_push_root((void**)&closure);
+  f = STELLA_OBJECT_CLOSURE_CALL(add_closure, acc);
+  f = STELLA_OBJECT_CLOSURE_CALL(f, STELLA_OBJECT_READ_FIELD(closure, 1));
+  gc_pop_root((void**)&closure);
+  return f;
+}
+
+static stella_object *mul_step(stella_object *closure, stella_object *i) {
+  stella_object *res;
+  gc_push_root((void**)&closure);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &add_k);
+  STELLA_OBJECT_INIT_FIELD(res, 1, STELLA_OBJECT_READ_FIELD(closure, 1));
+  gc_pop_root((void**)&closure);
+  return res;
+}
+
+static stella_object *mul_m(stella_object *closure, stella_object *k) {
+  stella_object *m = NULL, *f;
+  gc_push_root((void**)&k);
+  gc_push_root((void**)&m);
+  m = STELLA_OBJECT_READ_FIELD(closure, 1);
+  f = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(f, 0, &mul_step);
+  STELLA_OBJECT_INIT_FIELD(f, 1, k);
+  gc_pop_root((void**)&m);
+  gc_pop_root((void**)&k);
+  return stella_object_nat_rec(m, &the_ZERO, f);
+}
+
+static stella_object *mul(stella_object *closure, stella_object *m) {
+  stella_object *res;
+  gc_push_root((void**)&m);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &mul_m);
+  STELLA_OBJECT_INIT_FIELD(res, 1, m);
+  gc_pop_root((void**)&m);
+  return res;
+}
+
+static stella_object_1 the_mul = { .object_header = TAG_FN | 1 << 4, .object_fields = { &mul } };
+static stella_object *const mul_closure = (stella_object*)&the_mul;
+
+static stella_object *nat_arith_main(stella_object *closure, stella_object *n) {
+  stella_object *f;
+  gc_push_root((void**)&n);
+  f = STELLA_OBJECT_CLOSURE_CALL(mul_closure, n);
+  gc_pop_root((void**)&n);
+  return STELLA_OBJECT_CLOSURE_CALL(f, n);
+}
+
+static stella_object_1 the_nat_arith_main = { .object_header = TAG_FN | 1 << 4, .object_fields = { &nat_arith_main } };
+
+const stella_workload nat_arith_workload = {
+  .name = "nat_arith",
+  .input = 120,
+  .expected = 14400,
+  .main_closure = (stella_object*)&the_nat_arith_main,
+};
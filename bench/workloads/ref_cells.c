@@ -0,0 +1,60 @@
+#include "runtime.h"
+#include "workloads.h"
+
+/*
+ * fn main(n : Nat) -> Nat {
+ *   return (fn(r : &Nat) {
+ *     return (fn(_ : Unit) { return *r })(
+ *       Nat::rec(n, unit, fn(i : Nat) { return fn(u : Unit) { r := succ(*r); return u } }))
+ *   })(new(0))
+ * }
+ */
+
+static stella_object *increment(stella_object *closure, stella_object *u) {
+  stella_object *r = NULL, *x;
+  gc_push_root((void**)&u);
+  gc_push_root((void**)&r);
+  r = STELLA_OBJECT_READ_FIELD(closure, 1);
+  x = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(x, 0, STELLA_OBJECT_READ_FIELD(r, 0));
+  STELLA_OBJECT_WRITE_FIELD(r, 0, x);
+  gc_pop_root((void**)&r);
+  gc_pop_root((void**)&u);
+  return u;
+}
+
+static stella_object *step(stella_object *closure, stella_object *i) {
+  stella_object *res;
+  gc_push_root((void**)&closure);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &increment);
+  STELLA_OBJECT_INIT_FIELD(res, 1, STELLA_OBJECT_READ_FIELD(closure, 1));
+  gc_pop_root((void**)&closure);
+  return res;
+}
+
+static stella_object *ref_cells_main(stella_object *closure, stella_object *n) {
+  stella_object *r = NULL, *f = NULL;
+  gc_push_root((void**)&n);
+  gc_push_root((void**)&r);
+  gc_push_root((void**)&f);
+  r = alloc_stella_object(TAG_REF, 1);
+  STELLA_OBJECT_INIT_FIELD(r, 0, &the_ZERO);
+  f = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(f, 0, &step);
+  STELLA_OBJECT_INIT_FIELD(f, 1, r);
+  stella_object_nat_rec(n, &the_UNIT, f);
+  gc_pop_root((void**)&f);
+  gc_pop_root((void**)&r);
+  gc_pop_root((void**)&n);
+  return STELLA_OBJECT_READ_FIELD(r, 0);
+}
+
+static stella_object_1 the_ref_cells_main = { .object_header = TAG_FN | 1 << 4, .object_fields = { &ref_cells_main } };
+
+const stella_workload ref_cells_workload = {
+  .name = "ref_cells",
+  .input = 50000,
+  .expected = 50000,
+  .main_closure = (stella_object*)&the_ref_cells_main,
+};
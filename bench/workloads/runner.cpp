@@ -0,0 +1,186 @@
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "gc.h"
+#include "runtime.h"
+#include "workloads.h"
+
+// Runs Stella workload programs against liblich built in one configuration
+// (WORKLOAD_CONFIG, see bench/CMakeLists.txt).
+//
+// usage: workloads-CONFIG [--filter SUBSTRING] [--repeat N] [--out FILE]
+//
+// Every run happens in a fresh process (the collector is a global), the
+// median of each metric over --repeat runs is reported as JSON.
+
+#ifndef WORKLOAD_CONFIG
+#define WORKLOAD_CONFIG "default"
+#endif
+
+const stella_workload *workloads[] = {
+    &list_fold_workload,
+    &tree_workload,
+    &ref_cells_workload,
+    &nat_arith_workload,
+};
+
+struct Measurement {
+  // false if the process crashed (or the collector ran out of memory)
+  bool completed;
+  bool correct;
+  double wall_seconds;
+  double gc_seconds;
+  size_t peak_heap_bytes;
+  // heap limit of the sizing policy at the end of the run
+  size_t heap_limit_bytes;
+  size_t collections;
+  size_t incremental_collections;
+  size_t incremental_fallbacks;
+  long max_rss_kib;
+};
+
+Measurement run_child(const stella_workload &workload) {
+  auto start = std::chrono::steady_clock::now();
+  auto input = nat_to_stella_object(workload.input);
+  auto result = STELLA_OBJECT_CLOSURE_CALL(workload.main_closure, input);
+  auto end = std::chrono::steady_clock::now();
+  gc_stats stats;
+  gc_get_stats(&stats);
+  return Measurement{
+      .completed = true,
+      .correct = stella_object_to_nat(result) == workload.expected,
+      .wall_seconds = std::chrono::duration<double>(end - start).count(),
+      .gc_seconds = stats.gc_seconds,
+      .peak_heap_bytes = stats.bytes_used_max,
+      .heap_limit_bytes = stats.heap_limit,
+      .collections = stats.collections,
+      .incremental_collections = stats.incremental_collections,
+      .incremental_fallbacks = stats.incremental_fallbacks,
+      .max_rss_kib = 0,
+  };
+}
+
+// runs the workload in a forked process
+Measurement run(const stella_workload &workload) {
+  Measurement res{};
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return res;
+  }
+  std::cout.flush();
+  auto pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return res;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    // keep the report clean from collector diagnostics (out of memory)
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    auto m = run_child(workload);
+    auto written = write(fds[1], &m, sizeof(m));
+    _exit(written == sizeof(m) ? 0 : 1);
+  }
+  close(fds[1]);
+  auto n = read(fds[0], &res, sizeof(res));
+  close(fds[0]);
+  int status;
+  rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0 || n != sizeof(res)) {
+    // the collector exits with a non-zero status when out of memory
+    return Measurement{};
+  }
+  res.max_rss_kib = usage.ru_maxrss;
+  return res;
+}
+
+template <typename T>
+T median(const std::vector<Measurement> &runs, T Measurement::*field) {
+  std::vector<T> values;
+  for (auto &run : runs) {
+    values.push_back(run.*field);
+  }
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  std::string filter;
+  size_t repeat = 5;
+  std::string out_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--filter SUBSTRING] [--repeat N] [--out FILE]"
+                << std::endl;
+      return 2;
+    }
+  }
+  std::ofstream file;
+  if (!out_path.empty()) {
+    file.open(out_path);
+  }
+  std::ostream &out = out_path.empty() ? std::cout : file;
+  bool all_correct = true;
+  out << "{\n  \"config\": \"" << WORKLOAD_CONFIG << "\",\n";
+  out << "  \"repeat\": " << repeat << ",\n";
+  out << "  \"workloads\": [";
+  bool first = true;
+  for (auto workload : workloads) {
+    if (std::string(workload->name).find(filter) == std::string::npos) {
+      continue;
+    }
+    std::cerr << WORKLOAD_CONFIG << "/" << workload->name << std::endl;
+    std::vector<Measurement> runs;
+    const char *error = nullptr;
+    for (size_t i = 0; i < repeat && !error; i++) {
+      runs.push_back(run(*workload));
+      if (!runs.back().completed) {
+        error = "crashed or ran out of memory";
+      } else if (!runs.back().correct) {
+        error = "wrong result";
+        all_correct = false;
+      }
+    }
+    out << (first ? "\n" : ",\n") << "    {\"name\": \"" << workload->name
+        << "\", \"input\": " << workload->input;
+    if (error) {
+      out << ", \"error\": \"" << error << "\"";
+    } else {
+      out << ", \"wall_seconds\": " << median(runs, &Measurement::wall_seconds)
+          << ", \"gc_seconds\": " << median(runs, &Measurement::gc_seconds)
+          << ", \"peak_heap_bytes\": "
+          << median(runs, &Measurement::peak_heap_bytes)
+          << ", \"heap_limit_bytes\": "
+          << median(runs, &Measurement::heap_limit_bytes)
+          << ", \"max_rss_kib\": " << median(runs, &Measurement::max_rss_kib)
+          << ", \"collections\": " << median(runs, &Measurement::collections)
+          << ", \"incremental_collections\": "
+          << median(runs, &Measurement::incremental_collections)
+          << ", \"incremental_fallbacks\": "
+          << median(runs, &Measurement::incremental_fallbacks);
+    }
+    out << "}";
+    first = false;
+  }
+  out << "\n  ]\n}\n";
+  // running out of memory is a result, a wrong answer is a bug
+  return all_correct ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include "runtime.h"
+#include "workloads.h"
+
+/*
+ * fn add(m : Nat) -> (fn(Nat) -> Nat) {
+ *   return fn(n : Nat) { return Nat::rec(m, n, fn(_ : Nat) { return fn(acc : Nat) { return succ(acc) } }) }
+ * }
+ * fn build(d : Nat) -> Tree {
+ *   return match d { 0 => inl(unit) | succ(p) => inr({build(p), build(p)}) }
+ * }
+ * fn count(t : Tree) -> Nat {
+ *   return match t { inl(_) => succ(0) | inr(node) => succ(add(count(node.1))(count(node.2))) }
+ * }
+ * fn main(n : Nat) -> Nat { return count(build(n)) }
+ *
+ * where Tree = Unit + {Tree, Tree}
+ */
+
+static stella_object *succ_acc(stella_object *closure, stella_object *acc) {
+  stella_object *res;
+  gc_push_root((void**)&acc);
+  res = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(res, 0, acc);
+  gc_pop_root((void**)&acc);
+  return res;
+}
+
+static stella_object_1 the_succ_acc = { .object_header = TAG_FN | 1 << 4, .object_fields = { &succ_acc } };
+
+static stella_object *succ_step(stella_object *closure, stella_object *i) {
+  return (stella_object*)&the_succ_acc;
+}
+
+static stella_object_1 the_succ_step = { .object_header = TAG_FN | 1 << 4, .object_fields = { &succ_step } };
+
+static stella_object *add_m(stella_object *closure, stella_object *n) {
+  return stella_object_nat_rec(STELLA_OBJECT_READ_FIELD(closure, 1), n, (stella_object*)&the_succ_step);
+}
+
+static stella_object *add(stella_object *closure, stella_object *m) {
+  stella_object *res;
+  gc_push_root((void**)&m);
+  res = alloc_stella_object(TAG_FN, 2);
+  STELLA_OBJECT_INIT_FIELD(res, 0, &add_m);
+  STELLA_OBJECT_INIT_FIELD(res, 1, m);
+  gc_pop_root((void**)&m);
+  return res;
+}
+
+static stella_object_1 the_add = { .object_header = TAG_FN | 1 << 4, .object_fields = { &add } };
+static stella_object *const add_closure = (stella_object*)&the_add;
+
+static stella_object *build(stella_object *closure, stella_object *d) {
+  stella_object *left = NULL, *right = NULL, *node, *res;
+  if (STELLA_OBJECT_HEADER_TAG(d->object_header) == TAG_ZERO) {
+    res = alloc_stella_object(TAG_INL, 1);
+    STELLA_OBJECT_INIT_FIELD(res, 0, &the_UNIT);
+    return res;
+  }
+  gc_push_root((void**)&closure);
+  gc_push_root((void**)&d);
+  gc_push_root((void**)&left);
+  gc_push_root((void**)&right);
+  left = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_SUCC_ARG(d));
+  right = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_SUCC_ARG(d));
+  node = alloc_stella_object(TAG_TUPLE, 2);
+  STELLA_OBJECT_INIT_FIELD(node, 0, left);
+  STELLA_OBJECT_INIT_FIELD(node, 1, right);
+  left = node;
+  res = alloc_stella_object(TAG_INR, 1);
+  STELLA_OBJECT_INIT_FIELD(res, 0, left);
+  gc_pop_root((void**)&right);
+  gc_pop_root((void**)&left);
+  gc_pop_root((void**)&d);
+  gc_pop_root((void**)&closure);
+  return res;
+}
+
+static stella_object_1 the_build = { .object_header = TAG_FN | 1 << 4, .object_fields = { &build } };
+static stella_object *const build_closure = (stella_object*)&the_build;
+
+static stella_object *count(stella_object *closure, stella_object *t) {
+  stella_object *node = NULL, *left = NULL, *f, *n, *res;
+  if (STELLA_OBJECT_HEADER_TAG(t->object_header) == TAG_INL) {
+    res = alloc_stella_object(TAG_SUCC, 1);
+    STELLA_OBJECT_INIT_FIELD(res, 0, &the_ZERO);
+    return res;
+  }
+  gc_push_root((void**)&closure);
+  gc_push_root((void**)&node);
+  gc_push_root((void**)&left);
+  node = STELLA_OBJECT_READ_FIELD(t, 0);
+  left = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_READ_FIELD(node, 0));
+  f = STELLA_OBJECT_CLOSURE_CALL(add_closure, left);
+  left = f;
+  n = STELLA_OBJECT_CLOSURE_CALL(closure, STELLA_OBJECT_READ_FIELD(node, 1));
+  n = STELLA_OBJECT_CLOSURE_CALL(left, n);
+  left = n;
+  res = alloc_stella_object(TAG_SUCC, 1);
+  STELLA_OBJECT_INIT_FIELD(res, 0, left);
+  gc_pop_root((void**)&left);
+  gc_pop_root((void**)&node);
+  gc_pop_root((void**)&closure);
+  return res;
+}
+
+static stella_object_1 the_count = { .object_header = TAG_FN | 1 << 4, .object_fields = { &count } };
+static stella_object *const count_closure = (stella_object*)&the_count;
+
+static stella_object *tree_main(stella_object *closure, stella_object *n) {
+  stella_object *t;
+  t = STELLA_OBJECT_CLOSURE_CALL(build_closure, n);
+  return STELLA_OBJECT_CLOSURE_CALL(count_closure, t);
+}
+
+static stella_object_1 the_tree_main = { .object_header = TAG_FN | 1 << 4, .object_fields = { &tree_main } };
+
+const stella_workload tree_workload = {
+  .name = "tree",
+  .input = 14,
+  .expected = 32767,
+  .main_closure = (stella_object*)&the_tree_main,
+};
@@ -0,0 +1,33 @@
+#ifndef STELLA_WORKLOADS_H
+#define STELLA_WORKLOADS_H
+
+#include "runtime.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A workload program, written the way the Stella compiler emits C code.
+ * The runner calls main_closure with the input converted to a Nat.
+ */
+typedef struct {
+  const char *name;
+  int input;                    /**< Default input (Nat). */
+  int expected;                 /**< Expected result (Nat) for the default input. */
+  stella_object *main_closure;  /**< Closure of the main function. */
+} stella_workload;
+
+/** Build a list of n Nats, map succ over it and fold its length. */
+extern const stella_workload list_fold_workload;
+/** Build a complete binary tree of depth n and count its nodes. */
+extern const stella_workload tree_workload;
+/** Increment a reference cell n times through closures capturing it. */
+extern const stella_workload ref_cells_workload;
+/** Compute n * n with Nat::rec (unary arithmetic, deep Nats). */
+extern const stella_workload nat_arith_workload;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#include "alloc_profiler.hpp"
+
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+
+namespace gc {
+
+AllocProfiler::AllocProfiler(size_t sample_interval, uint64_t seed)
+    : sample_interval_(sample_interval), countdown_(*this, seed) {}
+
+AllocProfiler::Countdown::Countdown(const AllocProfiler &profiler,
+                                    uint64_t seed)
+    : sample_interval_(profiler.sample_interval_), bytes_until_sample_(0),
+      gen_(seed) {
+  if (sample_interval_ > 0) {
+    bytes_until_sample_ = next_sample_distance();
+  }
+}
+
+size_t AllocProfiler::Countdown::next_sample_distance() {
+  std::exponential_distribution<double> distr(
+      1.0 / static_cast<double>(sample_interval_));
+  return 1 + static_cast<size_t>(distr(gen_));
+}
+
+void AllocProfiler::record(int tag, size_t bytes, size_t skip_frames) {
+  if (!enabled() || !countdown_.sampled(bytes)) {
+    return;
+  }
+  // skip record() itself
+  sample(tag, bytes, skip_frames + 1);
+}
+
+void AllocProfiler::sample(int tag, size_t bytes, size_t skip_frames) {
+  void *buffer[max_frames + 8];
+  auto n = backtrace(buffer, max_frames + 8);
+  // skip sample() itself
+  auto skip = std::min(static_cast<size_t>(n), skip_frames + 1);
+  auto last = std::min(static_cast<size_t>(n), skip + max_frames);
+  record(tag, bytes, std::vector<void *>(&buffer[skip], &buffer[last]));
+}
+
+void AllocProfiler::record(int tag, size_t bytes,
+                           const std::vector<void *> &frames) {
+  if (!enabled()) {
+    return;
+  }
+  samples_++;
+  // probability that an allocation of this size is sampled
+  auto p = 1.0 - std::exp(-static_cast<double>(bytes) /
+                          static_cast<double>(sample_interval_));
+  auto &site = sites_[Key(tag, frames)];
+  site.samples++;
+  site.objects += 1.0 / p;
+  site.bytes += static_cast<double>(bytes) / p;
+}
+
+const std::map<AllocProfiler::Key, AllocProfiler::Site> &
+AllocProfiler::get_sites() const {
+  return sites_;
+}
+
+size_t AllocProfiler::get_samples() const { return samples_; }
+
+std::string frame_name(void *frame) {
+  Dl_info info;
+  if (dladdr(frame, &info) && info.dli_sname) {
+    return info.dli_sname;
+  }
+  return std::format("{}", frame);
+}
+
+void AllocProfiler::write_collapsed(
+    std::ostream &out, const std::function<std::string(int)> &tag_name) const {
+  for (auto &[key, site] : sites_) {
+    auto &[tag, frames] = key;
+    // backtrace is innermost first, collapsed stacks are outermost first
+    for (auto it = frames.rbegin(); it != frames.rend(); it++) {
+      out << frame_name(*it) << ';';
+    }
+    out << tag_name(tag) << ' ' << std::llround(site.bytes) << '\n';
+  }
+}
+
+} // namespace gc
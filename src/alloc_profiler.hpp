@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace gc {
+
+// Sampling allocation profiler.
+//
+// On average one allocation per `sample_interval` bytes is sampled (the
+// distance between samples is exponentially distributed, so small and large
+// objects are sampled without bias). A sample records the object tag, its
+// size and the return addresses of the allocating call stack; samples are
+// aggregated per (tag, stack) and scaled back to estimated totals.
+//
+// Non-sampled allocations only decrement a counter. Threads sharing a
+// profiler keep their own Countdown and lock it only to record a sample.
+class AllocProfiler {
+public:
+  static const size_t max_frames = 32;
+
+  // distance to the next sample
+  class Countdown {
+  public:
+    Countdown(const AllocProfiler &profiler, uint64_t seed);
+
+    // true if an allocation of `bytes` bytes is sampled
+    bool sampled(size_t bytes) {
+      if (bytes < bytes_until_sample_) {
+        bytes_until_sample_ -= bytes;
+        return false;
+      }
+      bytes_until_sample_ = next_sample_distance();
+      return true;
+    }
+
+  private:
+    const size_t sample_interval_;
+    size_t bytes_until_sample_;
+    std::mt19937_64 gen_;
+
+    size_t next_sample_distance();
+  };
+
+  struct Site {
+    size_t samples;
+    // estimated number of objects / bytes allocated at this site
+    double objects;
+    double bytes;
+  };
+
+  using Key = std::pair<int, std::vector<void *>>;
+
+  // sample_interval = 0 disables profiling
+  explicit AllocProfiler(size_t sample_interval, uint64_t seed = 0);
+
+  bool enabled() const { return sample_interval_ > 0; }
+
+  // `skip_frames` innermost frames of the caller (allocator internals) are
+  // not recorded
+  void record(int tag, size_t bytes, size_t skip_frames = 0);
+  // records an allocation sampled by a Countdown of the caller
+  [[gnu::noinline]] void sample(int tag, size_t bytes, size_t skip_frames = 0);
+
+  void record(int tag, size_t bytes, const std::vector<void *> &frames);
+
+  const std::map<Key, Site> &get_sites() const;
+  size_t get_samples() const;
+
+  // One line per site in collapsed-stack format (outermost frame first, tag
+  // as the leaf frame, estimated bytes as the value), as consumed by
+  // flamegraph.pl, speedscope, inferno, etc.
+  void write_collapsed(
+      std::ostream &out,
+      const std::function<std::string(int)> &tag_name) const;
+
+private:
+  const size_t sample_interval_;
+  Countdown countdown_;
+  std::map<Key, Site> sites_;
+  size_t samples_ = 0;
+};
+
+} // namespace gc
@@ -1,12 +1,40 @@
 #include "gc.h"
 
+#include <assert.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "alloc_profiler.hpp"
 #include "mark_and_sweep.hpp"
 #include "runtime.h"
+#include "shared_heap.hpp"
+#include "snapshot.hpp"
+#include "tables.hpp"
+
+// see STELLA_CONSERVATIVE_ROOTS in gc.h, the functions are still exported
+#undef gc_push_root
+#undef gc_pop_root
 
 #ifndef MAX_ALLOC_SIZE
 #define MAX_ALLOC_SIZE 1024
@@ -16,47 +44,723 @@
 #define INCREMENTAL 0
 #endif
 
+// Collections are triggered by a heap sizing policy: the heap limit starts at
+// this size and grows up to MAX_ALLOC_SIZE (or shrinks back) depending on how
+// much survives collections (0 = collect only when allocation fails)
+#ifndef MIN_HEAP_SIZE
+#define MIN_HEAP_SIZE 262144
+#endif
+
+// pages inside free blocks of at least this size are returned to the OS after
+// collections (0 = never, e.g. 65536), lazily (MADV_FREE) if DECOMMIT_LAZY is
+// non-zero
+#ifndef DECOMMIT_MIN_BLOCK_SIZE
+#define DECOMMIT_MIN_BLOCK_SIZE 0
+#endif
+
+#ifndef DECOMMIT_LAZY
+#define DECOMMIT_LAZY 0
+#endif
+
+// back heaps with 2 MiB huge pages: 0 = no, 1 = transparent huge pages,
+// 2 = explicit huge pages (falling back to transparent ones if the hugetlbfs
+// pool is too small)
+#ifndef HUGE_PAGES
+#define HUGE_PAGES 0
+#endif
+
+// objects of at least this size get their own mapping instead of a block in
+// the heap (0 = never)
+#ifndef LARGE_OBJECT_SIZE
+#define LARGE_OBJECT_SIZE 16384
+#endif
+
+// Stella headers share a word with block metadata (tag and field count in the
+// lowest byte), which saves a word per object (0 = separate words)
+#ifndef MERGED_HEADER
+#define MERGED_HEADER 0
+#endif
+
+// object fields are 32-bit references instead of pointers (requires
+// MERGED_HEADER, disables LARGE_OBJECT_SIZE), programs must be compiled with
+// the same STELLA_COMPRESSED_REFS (see runtime.h)
+#ifdef STELLA_COMPRESSED_REFS
+#define COMPRESSED_REFS 1
+#else
+#define COMPRESSED_REFS 0
+#endif
+
+// roots are found by scanning the stacks of all threads (words that point at
+// objects) instead of the roots pushed by generated code, programs compiled
+// with the same STELLA_CONSERVATIVE_ROOTS (see gc.h) don't push any
+#ifdef STELLA_CONSERVATIVE_ROOTS
+#define CONSERVATIVE_ROOTS 1
+#else
+#define CONSERVATIVE_ROOTS 0
+#endif
+
+// full collections mark with a stack of at most this many objects (objects
+// found while it is full are marked by pointer reversal), 0 = always use
+// pointer reversal
+#ifndef MARK_STACK_SIZE
+#define MARK_STACK_SIZE 65536
+#endif
+
+// in incremental mode, an allocation that fails finishes the cycle in
+// progress at once, if that doesn't free enough memory a whole new cycle is
+// run too unless this is 0
+#ifndef INCREMENTAL_FALLBACK_FULL
+#define INCREMENTAL_FALLBACK_FULL 1
+#endif
+
+// size of thread-local allocation buffers (0 = disabled), only used while
+// all threads' buffers fit in 1/16 of the heap limit and not in incremental
+// mode
+#ifndef TLAB_SIZE
+#define TLAB_SIZE 4096
+#endif
+
+// average number of bytes between sampled allocations (0 = no profiling)
+#ifndef ALLOC_PROFILE_INTERVAL
+#define ALLOC_PROFILE_INTERVAL 0
+#endif
+
+// every collection counts the live objects per Stella tag and size, printed
+// by print_gc_alloc_stats (0 = no census)
+#ifndef CENSUS
+#define CENSUS 0
+#endif
+
+// the census of every n-th collection is also kept and printed as a time
+// series (0 = none), implies CENSUS
+#ifndef CENSUS_HISTORY
+#define CENSUS_HISTORY 0
+#endif
+
 static_assert(MAX_ALLOC_SIZE > 0);
+static_assert(HUGE_PAGES >= 0 && HUGE_PAGES <= 2);
+static_assert(!COMPRESSED_REFS || MERGED_HEADER);
+
+std::string census_tag_name(size_t tag) {
+  return stella_tag_name(static_cast<enum TAG>(tag));
+}
+
+struct gc_heap {
+  gc_heap(uint64_t id, size_t max_memory, bool incremental)
+      : id(id), heap(max_memory, true, !MERGED_HEADER, incremental, TLAB_SIZE,
+                     std::min<size_t>(MIN_HEAP_SIZE, max_memory), {},
+                     static_cast<gc::HugePages>(HUGE_PAGES), MERGED_HEADER,
+                     COMPRESSED_REFS) {
+    if (CONSERVATIVE_ROOTS) {
+      heap.enable_conservative_roots();
+    }
+    heap.stop_the_world(nullptr, [](gc::MarkAndSweep &collector) {
+      collector.set_decommit(DECOMMIT_MIN_BLOCK_SIZE, DECOMMIT_LAZY);
+      collector.set_large_object_threshold(COMPRESSED_REFS ? 0
+                                                           : LARGE_OBJECT_SIZE);
+      if (MARK_STACK_SIZE > 0) {
+        collector.set_mark_strategy(gc::MarkStrategy::MARK_STACK,
+                                    MARK_STACK_SIZE);
+      } else {
+        collector.set_mark_strategy(gc::MarkStrategy::POINTER_REVERSAL);
+      }
+      if (CENSUS || CENSUS_HISTORY > 0) {
+        collector.set_census(true, TAG_MASK, CENSUS_HISTORY);
+      }
+    });
+  }
+
+  // unlike addresses, ids are never reused
+  const uint64_t id;
+  gc::SharedHeap heap;
+  // mutators of all threads that used the heap
+  std::mutex mutators_mutex;
+  std::unordered_map<std::thread::id,
+                     std::unique_ptr<gc::SharedHeap::Mutator>>
+      mutators;
+};
+
+// live heaps by id
+std::mutex heaps_mutex;
+std::unordered_map<uint64_t, std::shared_ptr<gc_heap>> heaps;
+uint64_t next_heap_id = 0;
+
+gc_heap *create_heap(size_t max_memory, bool incremental) {
+  std::lock_guard lock(heaps_mutex);
+  auto id = next_heap_id++;
+  auto heap = std::make_shared<gc_heap>(id, max_memory, incremental);
+  heaps.emplace(id, heap);
+  return heap.get();
+}
+
+gc_heap *const default_heap = create_heap(MAX_ALLOC_SIZE, INCREMENTAL);
+gc::AllocProfiler profiler(ALLOC_PROFILE_INTERVAL);
+std::mutex profiler_mutex;
+
+// Compressed references to pointers outside of heaps (static objects,
+// functions) are indices into this table, shared by all heaps. Entries are
+// never removed, programs only store a few distinct ones.
+const size_t max_external_refs = 1 << 16;
+std::array<std::atomic<void *>, max_external_refs> external_refs;
+std::mutex external_refs_mutex;
+std::unordered_map<void *, uint32_t> external_ref_ids;
+// references recently looked up by the calling thread (direct-mapped)
+thread_local std::array<std::pair<void *, gc::MarkAndSweep::ref_t>, 64>
+    external_ref_cache;
+
+// Heaps used by a thread. The thread runs on one of them (the last one
+// used) and is in a blocking region on all others, so that it doesn't hold
+// up their collections. When the thread exits, its mutators are removed from
+// the heaps that are still alive.
+struct ThreadHeaps {
+  gc_heap *current = nullptr;
+  std::vector<uint64_t> used;
+  uint64_t active_id = UINT64_MAX;
+  // Only valid while the heap is alive: used when the caller passes the
+  // heap, otherwise the heap is looked up by id, as another thread may have
+  // destroyed it.
+  gc::SharedHeap::Mutator *active = nullptr;
+
+  ~ThreadHeaps() {
+    for (auto id : used) {
+      std::shared_ptr<gc_heap> heap;
+      {
+        std::lock_guard lock(heaps_mutex);
+        auto it = heaps.find(id);
+        if (it == heaps.end()) {
+          continue;
+        }
+        heap = it->second;
+      }
+      std::unique_ptr<gc::SharedHeap::Mutator> mutator;
+      {
+        std::lock_guard lock(heap->mutators_mutex);
+        auto it = heap->mutators.find(std::this_thread::get_id());
+        mutator = std::move(it->second);
+        heap->mutators.erase(it);
+      }
+      // may wait for a collection, so no locks are held
+      mutator.reset();
+    }
+  }
+
+  void deactivate() {
+    if (active_id == UINT64_MAX) {
+      return;
+    }
+    std::shared_ptr<gc_heap> heap;
+    {
+      std::lock_guard lock(heaps_mutex);
+      auto it = heaps.find(active_id);
+      if (it != heaps.end()) {
+        heap = it->second;
+      }
+    }
+    active = nullptr;
+    active_id = UINT64_MAX;
+    if (!heap) {
+      // the mutator went away with the heap
+      return;
+    }
+    gc::SharedHeap::Mutator *self;
+    {
+      std::lock_guard lock(heap->mutators_mutex);
+      self = heap->mutators.at(std::this_thread::get_id()).get();
+    }
+    self->enter_blocking();
+  }
+};
+
+thread_local ThreadHeaps thread_heaps;
+
+gc_heap *current_heap() {
+  auto heap = thread_heaps.current;
+  return heap ? heap : default_heap;
+}
+
+// the calling thread's mutator, registered on first use
+gc::SharedHeap::Mutator &mutator(gc_heap *heap) {
+  auto &thread = thread_heaps;
+  if (thread.active_id == heap->id) {
+    return *thread.active;
+  }
+  thread.deactivate();
+  gc::SharedHeap::Mutator *self;
+  bool registered = false;
+  {
+    std::lock_guard lock(heap->mutators_mutex);
+    auto &mutator = heap->mutators[std::this_thread::get_id()];
+    if (!mutator) {
+      mutator = std::make_unique<gc::SharedHeap::Mutator>(heap->heap);
+      thread.used.push_back(heap->id);
+      registered = true;
+    }
+    self = mutator.get();
+  }
+  if (!registered) {
+    self->leave_blocking();
+  }
+  thread.active_id = heap->id;
+  thread.active = self;
+  return *self;
+}
+
+// runs f on the collector of the current heap with other threads stopped
+void with_collector(const std::function<void(gc::MarkAndSweep &)> &f) {
+  auto heap = current_heap();
+  heap->heap.stop_the_world(&mutator(heap), f);
+}
+
+gc_heap *gc_heap_create(size_t max_memory, int incremental) {
+  try {
+    return create_heap(max_memory, incremental);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
 
-gc::MarkAndSweep gcc(MAX_ALLOC_SIZE, true, true, INCREMENTAL);
+void gc_heap_destroy(gc_heap *heap) {
+  assert(heap != default_heap && "the default heap can't be destroyed");
+  auto &thread = thread_heaps;
+  if (thread.current == heap) {
+    thread.current = nullptr;
+  }
+  if (thread.active_id == heap->id) {
+    thread.active = nullptr;
+    thread.active_id = UINT64_MAX;
+  }
+  std::erase(thread.used, heap->id);
+  std::shared_ptr<gc_heap> destroyed;
+  {
+    std::lock_guard lock(heaps_mutex);
+    auto it = heaps.find(heap->id);
+    destroyed = std::move(it->second);
+    heaps.erase(it);
+  }
+  // unless an exiting thread still removes its mutator
+  destroyed.reset();
+}
+
+gc_heap *gc_heap_use(gc_heap *heap) {
+  auto &thread = thread_heaps;
+  auto previous = thread.current;
+  thread.current = heap;
+  if (thread.active_id != current_heap()->id) {
+    thread.deactivate();
+  }
+  return previous;
+}
+
+void *gc_heap_alloc(gc_heap *heap, size_t size_in_bytes) {
+  auto &self = mutator(heap);
+  auto try_alloc = self.allocate(size_in_bytes);
+  if (try_alloc) {
+    return try_alloc;
+  }
+  if (!heap->heap.incremental()) {
+    return self.collect_and_allocate(size_in_bytes);
+  }
+  // the cycle in progress may be about to free enough memory
+  try_alloc = self.finish_cycle_and_allocate(size_in_bytes);
+  if (try_alloc || !INCREMENTAL_FALLBACK_FULL) {
+    return try_alloc;
+  }
+  // objects that died while it was marking survived it
+  return self.finish_cycle_and_allocate(size_in_bytes);
+}
 
 void *gc_alloc(size_t size_in_bytes) {
-  if (INCREMENTAL) {
-    auto try_alloc = gcc.allocate(size_in_bytes);
-    if (try_alloc) {
-      return try_alloc;
+  auto try_alloc = gc_heap_alloc(current_heap(), size_in_bytes);
+  if (try_alloc) {
+    return try_alloc;
+  }
+  std::cerr << "[ERROR] out of memory!" << std::endl;
+  print_gc_alloc_stats();
+  exit(1);
+}
+
+int gc_heap_reserve(gc_heap *heap, size_t count, size_t size_in_bytes) {
+  return mutator(heap).reserve(count, size_in_bytes);
+}
+
+int gc_reserve(size_t count, size_t size_in_bytes) {
+  return gc_heap_reserve(current_heap(), count, size_in_bytes);
+}
+
+void *gc_alloc_reserved(size_t size_in_bytes) {
+  auto obj = mutator(current_heap()).allocate_reserved(size_in_bytes);
+  return obj ? obj : gc_alloc(size_in_bytes);
+}
+
+void gc_heap_collect(gc_heap *heap) { mutator(heap).collect(); }
+
+void gc_collect() { gc_heap_collect(current_heap()); }
+
+int gc_heap_step(gc_heap *heap, size_t budget_bytes, double budget_seconds) {
+  auto deadline = gc::clock::time_point::max();
+  if (budget_seconds > 0) {
+    deadline = gc::clock::now() +
+               std::chrono::duration_cast<gc::clock::duration>(
+                   std::chrono::duration<double>(budget_seconds));
+  }
+  return mutator(heap).step(budget_bytes, deadline);
+}
+
+int gc_step(size_t budget_bytes, double budget_seconds) {
+  return gc_heap_step(current_heap(), budget_bytes, budget_seconds);
+}
+
+void gc_profile_alloc(int tag, size_t size_in_bytes) {
+  if (!profiler.enabled()) {
+    return;
+  }
+  thread_local gc::AllocProfiler::Countdown countdown(
+      profiler, std::hash<std::thread::id>()(std::this_thread::get_id()));
+  if (!countdown.sampled(size_in_bytes)) {
+    return;
+  }
+  std::lock_guard lock(profiler_mutex);
+  // skip gc_profile_alloc and alloc_stella_object
+  profiler.sample(tag, size_in_bytes, 2);
+}
+
+void print_gc_alloc_profile(FILE *out) {
+  std::ostringstream collapsed;
+  {
+    std::lock_guard lock(profiler_mutex);
+    profiler.write_collapsed(collapsed, [](int tag) {
+      return std::string(stella_tag_name(static_cast<enum TAG>(tag)));
+    });
+  }
+  fputs(collapsed.str().c_str(), out);
+}
+
+int write_heap_snapshot(const gc::MarkAndSweep &collector, const char *path,
+                        int background) {
+  // The file and the stream's buffer are set up before fork(): other threads
+  // may hold the allocator's locks, so the child only calls write(2).
+  auto fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  tables::FdStream out(fd);
+  auto write = [&collector, &out, fd]() {
+    collector.write_snapshot(out);
+    out.flush();
+    auto written = out.good();
+    return close(fd) == 0 && written ? 0 : -1;
+  };
+  if (!background) {
+    return write();
+  }
+  // the heap is copy-on-write in the child, the grandchild is reaped by init
+  fflush(nullptr);
+  auto pid = fork();
+  if (pid == 0) {
+    auto grandchild = fork();
+    if (grandchild == 0) {
+      _exit(write() == 0 ? 0 : 1);
     }
-    std::cerr << "[ERROR] out of memory!" << std::endl;
-    print_gc_alloc_stats();
-    exit(1);
-  } else {
-    auto try_alloc = gcc.allocate(size_in_bytes);
-    if (try_alloc) {
-      return try_alloc;
+    _exit(grandchild < 0 ? 1 : 0);
+  }
+  close(fd);
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+    return -1;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int gc_write_heap_snapshot(const char *path, int background) {
+  int res = 0;
+  with_collector([&](gc::MarkAndSweep &collector) {
+    res = write_heap_snapshot(collector, path, background);
+  });
+  return res;
+}
+
+// Pointers outside of heaps in an image (static objects, functions) are
+// relocated with the program the runtime is linked into.
+const void *const image_external_base = &the_ZERO;
+
+// the loaded segments (text, data, bss) of the program or shared library
+// that contains image_external_base
+gc::MarkAndSweep::MemoryRange image_external_range() {
+  struct Search {
+    uintptr_t address;
+    uintptr_t begin = 0;
+    uintptr_t end = 0;
+  } search{reinterpret_cast<uintptr_t>(image_external_base)};
+  dl_iterate_phdr(
+      [](dl_phdr_info *info, size_t, void *data) {
+        auto search = static_cast<Search *>(data);
+        auto begin = std::numeric_limits<uintptr_t>::max();
+        uintptr_t end = 0;
+        for (size_t i = 0; i < info->dlpi_phnum; i++) {
+          auto &segment = info->dlpi_phdr[i];
+          if (segment.p_type == PT_LOAD) {
+            auto start = info->dlpi_addr + segment.p_vaddr;
+            begin = std::min<uintptr_t>(begin, start);
+            end = std::max<uintptr_t>(end, start + segment.p_memsz);
+          }
+        }
+        if (begin <= search->address && search->address < end) {
+          search->begin = begin;
+          search->end = end;
+          return 1;
+        }
+        return 0;
+      },
+      &search);
+  return {reinterpret_cast<const void *>(search.begin),
+          reinterpret_cast<const void *>(search.end)};
+}
+
+int gc_heap_write_image(gc_heap *heap, const char *path, void **roots,
+                        size_t n_roots) {
+  if (COMPRESSED_REFS) {
+    // external references are indices into this process's table
+    return -1;
+  }
+  auto &self = mutator(heap);
+  for (size_t i = 0; i < n_roots; i++) {
+    self.push_root(&roots[i]);
+  }
+  self.collect();
+  // Written next to the target and renamed over it: processes that have the
+  // old image mapped keep it, truncating it would make their pages fail with
+  // SIGBUS.
+  auto tmp_path = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+  int res = 0;
+  try {
+    heap->heap.stop_the_world(&self, [&](gc::MarkAndSweep &collector) {
+      std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+      collector.write_image(out, std::vector<void *>(roots, roots + n_roots),
+                            image_external_base, image_external_range());
+      out.close();
+      res = out.good() && rename(tmp_path.c_str(), path) == 0 ? 0 : -1;
+    });
+  } catch (const std::runtime_error &) {
+    res = -1;
+  }
+  if (res != 0) {
+    unlink(tmp_path.c_str());
+  }
+  for (size_t i = n_roots; i > 0; i--) {
+    self.pop_root(&roots[i - 1]);
+  }
+  return res;
+}
+
+int gc_write_image(const char *path, void **roots, size_t n_roots) {
+  return gc_heap_write_image(current_heap(), path, roots, n_roots);
+}
+
+int gc_heap_load_image(gc_heap *heap, const char *path, void **roots,
+                       size_t n_roots) {
+  if (COMPRESSED_REFS) {
+    return -1;
+  }
+  auto fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int res = -1;
+  // the number of roots is checked before the heap is touched
+  gc::SnapshotHeader header;
+  if (pread(fd, &header, sizeof(header), 0) ==
+          static_cast<ssize_t>(sizeof(header)) &&
+      header.n_roots == n_roots) {
+    try {
+      auto loaded = mutator(heap).load_image(fd, image_external_base);
+      std::copy(loaded.begin(), loaded.end(), roots);
+      res = 0;
+    } catch (const std::exception &) {
     }
-    gcc.collect();
-    try_alloc = gcc.allocate(size_in_bytes);
-    if (try_alloc) {
-      return try_alloc;
+  }
+  close(fd);
+  return res;
+}
+
+int gc_load_image(const char *path, void **roots, size_t n_roots) {
+  return gc_heap_load_image(current_heap(), path, roots, n_roots);
+}
+
+void gc_heap_get_stats(gc_heap *heap, gc_stats *stats) {
+  auto [s, heap_limit] = heap->heap.published_stats();
+  stats->collections = s.collections;
+  stats->incremental_collections = s.incremental_collections;
+  stats->incremental_fallbacks = s.incremental_fallbacks;
+  stats->bytes_used = s.bytes_used;
+  stats->bytes_used_max = s.bytes_used_max;
+  stats->heap_bytes = heap->heap.collector().max_memory;
+  stats->heap_limit = heap_limit;
+  stats->bytes_decommitted = s.bytes_decommitted;
+  stats->bytes_large_objects = s.bytes_large_objects;
+  stats->gc_seconds =
+      1e-9 * (s.full_pauses.total_ns + s.incremental_pauses.total_ns);
+}
+
+void gc_get_stats(gc_stats *stats) { gc_heap_get_stats(current_heap(), stats); }
+
+size_t gc_heap_get_census(gc_heap *heap, gc_census_entry *by_tag,
+                          size_t n_tags) {
+  auto census = heap->heap.published_census();
+  for (size_t tag = 0; tag < n_tags; tag++) {
+    by_tag[tag] = {};
+    if (tag < census.by_kind.size()) {
+      by_tag[tag].objects = census.by_kind[tag].objects;
+      by_tag[tag].bytes = census.by_kind[tag].bytes;
     }
-    std::cerr << "[ERROR] out of memory!" << std::endl;
-    print_gc_alloc_stats();
-    exit(1);
   }
+  return census.collection;
 }
 
-void print_gc_roots() { std::cout << gcc.dump_roots() << std::endl; }
+size_t gc_get_census(gc_census_entry *by_tag, size_t n_tags) {
+  return gc_heap_get_census(current_heap(), by_tag, n_tags);
+}
 
-void print_gc_alloc_stats() { std::cout << gcc.dump_stats() << std::endl; }
+void print_gc_roots() {
+  with_collector([](gc::MarkAndSweep &collector) {
+    collector.dump_roots(std::cout);
+    std::cout << std::endl;
+  });
+}
 
-void print_gc_state() { std::cout << gcc.dump() << std::endl; }
+void print_gc_alloc_stats() {
+  with_collector([](gc::MarkAndSweep &collector) {
+    collector.dump_stats(std::cout);
+    if (collector.census().collection > 0) {
+      std::cout << "\n";
+      collector.dump_census(std::cout, census_tag_name);
+    }
+    if (!collector.census_history().empty()) {
+      std::cout << "\nCENSUS HISTORY\n";
+      collector.dump_census_history(std::cout, census_tag_name);
+    }
+    std::cout << std::endl;
+  });
+}
 
-void gc_read_barrier(void *obj, int) { gcc.read(obj); }
+void print_gc_state() {
+  with_collector([](gc::MarkAndSweep &collector) {
+    collector.dump(std::cout);
+    std::cout << std::endl;
+  });
+}
+
+void print_gc_state_sampled(FILE *out, size_t max_rows, size_t sample_every) {
+  with_collector([=](gc::MarkAndSweep &collector) {
+    tables::FileStream stream(out);
+    collector.dump(stream, gc::DumpOptions{.max_rows = max_rows,
+                                           .sample_every = sample_every});
+    stream << std::endl;
+  });
+}
 
-void gc_write_barrier(void *obj, int, void *contents) {
-  gcc.write(obj, contents);
+void gc_heap_read_barrier(gc_heap *heap, void *obj, int) {
+  mutator(heap).read(obj);
 }
 
-void gc_push_root(void **ptr) { gcc.push_root(ptr); }
+void gc_heap_write_barrier(gc_heap *heap, void *obj, int, void *contents) {
+  mutator(heap).write(obj, contents);
+}
+
+void gc_heap_push_root(gc_heap *heap, void **ptr) {
+  mutator(heap).push_root(ptr);
+}
+
+void gc_heap_pop_root(gc_heap *heap, void **ptr) {
+  mutator(heap).pop_root(ptr);
+}
+
+gc::MarkAndSweep::ref_t external_ref(void *ptr) {
+  auto &cached = external_ref_cache[(reinterpret_cast<uintptr_t>(ptr) >> 3) %
+                                    external_ref_cache.size()];
+  if (cached.first == ptr) {
+    return cached.second;
+  }
+  uint32_t idx;
+  {
+    std::lock_guard lock(external_refs_mutex);
+    auto [it, inserted] =
+        external_ref_ids.try_emplace(ptr, external_ref_ids.size());
+    idx = it->second;
+    if (inserted) {
+      if (idx >= max_external_refs) {
+        std::cerr << "[ERROR] too many pointers outside of the heap!"
+                  << std::endl;
+        exit(1);
+      }
+      external_refs[idx].store(ptr, std::memory_order_release);
+    }
+  }
+  cached = {ptr, idx | gc::MarkAndSweep::external_ref_bit};
+  return cached.second;
+}
+
+// Compressed references depend on the heap's address range, which
+// load_image changes with the world stopped: the calling thread must run on
+// the heap (not be in a blocking region) so that it is stopped meanwhile.
+void *gc_heap_load_field(gc_heap *heap, void *object, int field_index) {
+  auto obj = static_cast<stella_object *>(object);
+  auto &collector = heap->heap.collector();
+  if (!collector.compressed_refs) {
+    return obj->object_fields[field_index];
+  }
+  mutator(heap);
+  // static objects keep pointers
+  if (!collector.contains(obj)) {
+    return obj->object_fields[field_index];
+  }
+  auto ref = reinterpret_cast<gc::MarkAndSweep::ref_t *>(
+      obj->object_fields)[field_index];
+  if (ref & gc::MarkAndSweep::external_ref_bit) {
+    return external_refs[ref & ~gc::MarkAndSweep::external_ref_bit].load(
+        std::memory_order_acquire);
+  }
+  return collector.decompress(ref);
+}
+
+void gc_heap_store_field(gc_heap *heap, void *object, int field_index,
+                         void *contents) {
+  auto obj = static_cast<stella_object *>(object);
+  auto &collector = heap->heap.collector();
+  if (!collector.compressed_refs) {
+    obj->object_fields[field_index] = contents;
+    return;
+  }
+  mutator(heap);
+  if (!collector.contains(obj)) {
+    obj->object_fields[field_index] = contents;
+    return;
+  }
+  reinterpret_cast<gc::MarkAndSweep::ref_t *>(obj->object_fields)
+      [field_index] = contents == nullptr || collector.contains(contents)
+                          ? collector.compress(contents)
+                          : external_ref(contents);
+}
+
+void *gc_load_field(void *object, int field_index) {
+  return gc_heap_load_field(current_heap(), object, field_index);
+}
+
+void gc_store_field(void *object, int field_index, void *contents) {
+  gc_heap_store_field(current_heap(), object, field_index, contents);
+}
+
+void gc_read_barrier(void *obj, int field_index) {
+  gc_heap_read_barrier(current_heap(), obj, field_index);
+}
+
+void gc_write_barrier(void *obj, int field_index, void *contents) {
+  gc_heap_write_barrier(current_heap(), obj, field_index, contents);
+}
+
+void gc_push_root(void **ptr) { gc_heap_push_root(current_heap(), ptr); }
+
+void gc_pop_root(void **ptr) { gc_heap_pop_root(current_heap(), ptr); }
+
+void gc_enter_blocking() { mutator(current_heap()).enter_blocking(); }
 
-void gc_pop_root(void **ptr) { gcc.pop_root(ptr); }
+void gc_leave_blocking() { mutator(current_heap()).leave_blocking(); }
@@ -19,9 +19,52 @@ extern "C" {
 /** Allocate an object on the heap of AT LEAST size_in_bytes bytes.
  * If necessary, this should start/continue garbage collection.
  * Returns a pointer to the newly allocated object.
+ *
+ * With MERGED_HEADER, the first word of the object is shared
+ * with the GC: only its lowest byte (the Stella tag and field count) belongs
+ * to the object, the other bits must be kept when writing the header.
  */
 void* gc_alloc(size_t size_in_bytes);
 
+/** Reserve room on the current heap for count objects of size_in_bytes bytes
+ * each (with at most one collection), so that the next count calls of
+ * gc_alloc_reserved(size_in_bytes) by the calling thread only bump a pointer
+ * and can't start a collection. Other allocations of the thread use up the
+ * same room. Returns 0 if no room could be reserved (out of memory, no free
+ * block large enough, or in incremental mode), gc_alloc_reserved then works
+ * like gc_alloc. A collection is only started if the heap is short of free
+ * memory, not just of a large enough block.
+ */
+int gc_reserve(size_t count, size_t size_in_bytes);
+/** Allocate an object in the room reserved by gc_reserve
+ * (with gc_alloc if there is none left).
+ */
+void *gc_alloc_reserved(size_t size_in_bytes);
+
+/** Collect the current heap at once (in incremental mode: finish the cycle
+ * in progress and run a whole new one). Like gc_alloc, this is a safepoint:
+ * every live object must be reachable from roots.
+ */
+void gc_collect();
+
+/** Do collector work ahead of time on the current heap, e.g. between requests
+ * or while waiting for input, so that less is left for gc_alloc. In
+ * incremental mode, advance the cycle in progress by about budget_bytes bytes
+ * of marking and sweeping (0 = no limit) or until budget_seconds have passed
+ * (0 = no limit), whichever comes first, but not past the end of the cycle.
+ * Otherwise, run the collection that the next allocations would start (see
+ * MIN_HEAP_SIZE) if there is one, regardless of the budget.
+ * Returns non-zero if a cycle (or collection) finished. A safepoint, like
+ * gc_collect.
+ */
+int gc_step(size_t budget_bytes, double budget_seconds);
+
+/** Report an allocation of size_in_bytes bytes for an object with a given tag
+ * to the sampling allocation profiler (see ALLOC_PROFILE_INTERVAL).
+ * Unless the allocation is sampled, this only decrements a counter.
+ */
+void gc_profile_alloc(int tag, size_t size_in_bytes);
+
 /** GC-specific code which must be executed on each READ operation.
  */
 void gc_read_barrier(void *object, int field_index);
@@ -30,6 +73,15 @@ void gc_read_barrier(void *object, int field_index);
  */
 void gc_write_barrier(void *object, int field_index, void *contents);
 
+/** Read / (over)write the field_index-th field of a Stella object without
+ * barriers, used by runtime.h with STELLA_COMPRESSED_REFS (the library must
+ * be built with it too). Fields of objects in the heap are then 32-bit
+ * references, static objects keep pointers. Pointers outside of the heap
+ * (static objects, functions) are stored as indices into a table.
+ */
+void *gc_load_field(void *object, int field_index);
+void gc_store_field(void *object, int field_index, void *contents);
+
 /** Push a reference to a root (variable) on the GC's stack of roots.
  */
 void gc_push_root(void **object);
@@ -38,6 +90,110 @@ void gc_push_root(void **object);
  */
 void gc_pop_root(void **object);
 
+/** With STELLA_CONSERVATIVE_ROOTS (the library must be built with it too),
+ * the GC finds roots by scanning the stacks of all threads for pointers to
+ * objects, and pushing / popping roots compiles to nothing.
+ */
+#ifdef STELLA_CONSERVATIVE_ROOTS
+#define gc_push_root(object) ((void)(object))
+#define gc_pop_root(object) ((void)(object))
+#endif
+
+/** Mark the calling thread as blocked outside of the runtime (waiting for I/O,
+ * joining other threads, etc.), so that collections started by other threads
+ * don't wait for it. The thread must not access the heap until
+ * gc_leave_blocking.
+ *
+ * The runtime can be used from several threads: every thread has its own
+ * roots and allocation buffer, collections stop all threads at their next
+ * allocation.
+ */
+void gc_enter_blocking();
+/** Leave a region started with gc_enter_blocking
+ * (waits for a collection in progress to finish).
+ */
+void gc_leave_blocking();
+
+/** A snapshot of GC statistics (see gc_get_stats). */
+typedef struct {
+  size_t collections;             /**< Number of full collections. */
+  size_t incremental_collections; /**< Number of finished incremental cycles. */
+  size_t incremental_fallbacks;   /**< Incremental cycles finished at once
+                                       because an allocation failed. */
+  size_t bytes_used;              /**< Current heap use (with block metadata). */
+  size_t bytes_used_max;          /**< Peak heap use (with block metadata). */
+  size_t heap_bytes;              /**< Heap size. */
+  size_t heap_limit;              /**< Heap size limit (see MIN_HEAP_SIZE). */
+  size_t bytes_decommitted;       /**< Free memory currently returned to the
+                                       OS (see DECOMMIT_MIN_BLOCK_SIZE). */
+  size_t bytes_large_objects;     /**< Large objects (not in bytes_used). */
+  double gc_seconds;              /**< Total time spent in GC pauses. */
+} gc_stats;
+
+/** Fill in GC statistics as of the last time all threads were stopped (the
+ * last collection, gc_step, incremental phase change, ...). Other threads
+ * keep running, so it can be polled cheaply.
+ */
+void gc_get_stats(gc_stats *stats);
+
+/** Live objects of one Stella tag (see gc_get_census). */
+typedef struct {
+  size_t objects; /**< Number of objects. */
+  size_t bytes;   /**< Their size (with block metadata). */
+} gc_census_entry;
+
+/** Fill in by_tag[tag] for the first n_tags tags (see enum TAG in runtime.h)
+ * with the objects that survived the last collection (see CENSUS).
+ * Returns the number of collections finished when the census was taken,
+ * 0 if there is none yet. Like gc_get_stats, other threads keep running.
+ */
+size_t gc_get_census(gc_census_entry *by_tag, size_t n_tags);
+
+/** An independent heap: its own memory, collector, roots and statistics.
+ * Several Stella programs can run in one process, each on its own heap.
+ */
+typedef struct gc_heap gc_heap;
+
+/** Create a heap of max_memory bytes (collected incrementally if incremental
+ * is non-zero). Returns NULL if the memory can't be allocated.
+ */
+gc_heap *gc_heap_create(size_t max_memory, int incremental);
+/** Free a heap with all of its objects at once (nothing is traced).
+ * No thread may use the heap afterwards. The default heap can't be destroyed.
+ */
+void gc_heap_destroy(gc_heap *heap);
+/** Make heap the current heap of the calling thread (NULL = the default heap
+ * of MAX_ALLOC_SIZE bytes). All functions without a heap argument (gc_alloc,
+ * gc_push_root, print_gc_state, ...) use the current heap.
+ * Returns the previous current heap.
+ *
+ * A thread runs on one heap at a time (the last one it used) and is treated
+ * as being in a blocking region (see gc_enter_blocking) by all other heaps,
+ * so its roots must stay valid until it switches back.
+ */
+gc_heap *gc_heap_use(gc_heap *heap);
+
+/** Same as gc_alloc, but returns NULL if heap is out of memory. */
+void *gc_heap_alloc(gc_heap *heap, size_t size_in_bytes);
+int gc_heap_reserve(gc_heap *heap, size_t count, size_t size_in_bytes);
+void gc_heap_collect(gc_heap *heap);
+int gc_heap_step(gc_heap *heap, size_t budget_bytes, double budget_seconds);
+void gc_heap_read_barrier(gc_heap *heap, void *object, int field_index);
+void gc_heap_write_barrier(gc_heap *heap, void *object, int field_index,
+                           void *contents);
+void *gc_heap_load_field(gc_heap *heap, void *object, int field_index);
+void gc_heap_store_field(gc_heap *heap, void *object, int field_index,
+                         void *contents);
+void gc_heap_push_root(gc_heap *heap, void **object);
+void gc_heap_pop_root(gc_heap *heap, void **object);
+void gc_heap_get_stats(gc_heap *heap, gc_stats *stats);
+size_t gc_heap_get_census(gc_heap *heap, gc_census_entry *by_tag,
+                          size_t n_tags);
+int gc_heap_write_image(gc_heap *heap, const char *path, void **roots,
+                        size_t n_roots);
+int gc_heap_load_image(gc_heap *heap, const char *path, void **roots,
+                       size_t n_roots);
+
 /** Print GC statistics. Output must include at least:
  *
  * 1. Total allocated memory (bytes and objects).
@@ -57,6 +213,47 @@ void print_gc_alloc_stats();
  */
 void print_gc_state();
 
+/** Print GC state (see print_gc_state) to a file, showing at most max_rows
+ * heap words (0 = no limit) and only every sample_every-th block.
+ * Useful for huge heaps.
+ */
+void print_gc_state_sampled(FILE *out, size_t max_rows, size_t sample_every);
+
+/** Print sampled allocation sites in collapsed-stack format
+ * (one "frame;frame;...;TAG bytes" line per call site),
+ * suitable for flame graph tools.
+ */
+void print_gc_alloc_profile(FILE *out);
+
+/** Write a binary heap snapshot (blocks, roots and freelist) to a file,
+ * to be inspected offline with the heap-analyzer tool.
+ * If background is non-zero, the snapshot is written by a forked process,
+ * so the program is only paused for the fork.
+ * Returns 0 on success.
+ */
+int gc_write_heap_snapshot(const char *path, int background);
+
+/** Write an image of the current heap to a file, so that later runs of the
+ * same program can start from it (see gc_load_image) instead of building the
+ * same objects again, e.g. large immutable structures built at startup.
+ * A collection is run first, everything that survives it is saved with
+ * roots[0..n_roots) as the image's roots. An existing file is replaced, not
+ * overwritten, so heaps that loaded it keep their objects.
+ * Not supported with STELLA_COMPRESSED_REFS.
+ * Returns 0 on success.
+ */
+int gc_write_image(const char *path, void **roots, size_t n_roots);
+/** Load an image written by gc_write_image (by the same program, built with
+ * the same options) into the current heap, which must not hold any objects
+ * yet, and store its roots into roots[0..n_roots) (n_roots must be the same
+ * as when it was written). The file is mapped copy-on-write, at the address
+ * it was written from if that is free, so only pointers that moved are
+ * rewritten. Other threads running on the heap are stopped meanwhile.
+ * The roots must be pushed like any other roots afterwards.
+ * Returns 0 on success, the heap stays empty otherwise.
+ */
+int gc_load_image(const char *path, void **roots, size_t n_roots);
+
 /** Print current GC roots (addresses).
  * May be useful for debugging.
  */
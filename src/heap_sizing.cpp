@@ -0,0 +1,57 @@
+#include "heap_sizing.hpp"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace gc {
+
+HeapSizing::HeapSizing(size_t min_bytes, size_t max_bytes,
+                       HeapSizingOptions options)
+    : min_bytes_(std::clamp<size_t>(min_bytes, 1, max_bytes)),
+      max_bytes_(max_bytes),
+      options_(options), limit_(min_bytes_) {
+  assert(options.target_occupancy > 0 && options.target_occupancy <= 1);
+  update_trigger(0);
+}
+
+void HeapSizing::collected(size_t live_bytes, uint64_t gc_ns,
+                           uint64_t elapsed_ns) {
+  auto survival =
+      static_cast<double>(live_bytes) / static_cast<double>(limit_);
+  auto gc_fraction = elapsed_ns > 0 ? static_cast<double>(gc_ns) /
+                                          static_cast<double>(elapsed_ns)
+                                    : 0.0;
+  if (survival > options_.grow_survival ||
+      gc_fraction > options_.max_gc_fraction) {
+    grow();
+  } else if (survival < options_.shrink_survival &&
+             gc_fraction < options_.max_gc_fraction / 2) {
+    limit_ /= 2;
+  }
+  // live data alone must not reach the trigger
+  while (limit_ < max_bytes_ &&
+         static_cast<double>(limit_) * options_.target_occupancy <=
+             static_cast<double>(live_bytes)) {
+    grow();
+  }
+  limit_ = std::clamp(limit_, min_bytes_, max_bytes_);
+  update_trigger(live_bytes);
+}
+
+void HeapSizing::grow() {
+  limit_ = limit_ > max_bytes_ / 2 ? max_bytes_ : limit_ * 2;
+}
+
+void HeapSizing::update_trigger(size_t live_bytes) {
+  trigger_ = static_cast<size_t>(static_cast<double>(limit_) *
+                                 options_.target_occupancy);
+  // a heap full of live data is collected after half of the rest is used
+  if (live_bytes < limit_) {
+    trigger_ = std::max(trigger_, live_bytes + (limit_ - live_bytes) / 2);
+  } else {
+    trigger_ = live_bytes;
+  }
+}
+
+} // namespace gc
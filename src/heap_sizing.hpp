@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <cstdint>
+
+namespace gc {
+
+struct HeapSizingOptions {
+  // collect once this fraction of the heap limit is used
+  double target_occupancy = 0.75;
+  // grow the limit if more than this fraction of it survives a collection
+  double grow_survival = 0.5;
+  // shrink the limit if less than this fraction of it survives
+  double shrink_survival = 0.125;
+  // grow the limit if more than this fraction of time is spent collecting
+  double max_gc_fraction = 0.05;
+};
+
+// Heap sizing policy for full collections.
+//
+// The heap is reserved at its maximum size, the policy keeps a soft limit
+// between `min_bytes` and `max_bytes` and asks for a collection once
+// `target_occupancy` of the limit is used (instead of when allocation
+// fails). After every collection the limit is doubled if too much survived
+// or the program spent too much time in GC, and halved if little survived.
+class HeapSizing {
+public:
+  HeapSizing(size_t min_bytes, size_t max_bytes,
+             HeapSizingOptions options = {});
+
+  size_t limit() const { return limit_; }
+  size_t trigger() const { return trigger_; }
+  bool should_collect(size_t bytes_used) const {
+    return bytes_used >= trigger_;
+  }
+
+  // `gc_ns` is the time spent in the collection, `elapsed_ns` the time since
+  // the end of the previous one (including `gc_ns`)
+  void collected(size_t live_bytes, uint64_t gc_ns, uint64_t elapsed_ns);
+
+private:
+  const size_t min_bytes_;
+  const size_t max_bytes_;
+  const HeapSizingOptions options_;
+  size_t limit_;
+  size_t trigger_;
+
+  void grow();
+  void update_trigger(size_t live_bytes);
+};
+
+} // namespace gc
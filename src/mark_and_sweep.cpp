@@ -1,131 +1,434 @@
 #include "mark_and_sweep.hpp"
 
 #include <assert.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <utility>
 
+#include "snapshot.hpp"
 #include "tables.hpp"
 
 namespace gc {
 
-bool log(std::string msg) {
+bool log([[maybe_unused]] std::string msg) {
 #ifndef NDEBUG
   std::cout << msg << std::endl;
 #endif
   return false;
 }
 
-std::string pointer_to_hex(void *ptr) {
+// pointer as "00 00 7f ff f5 70 91 f0", formatted without allocations
+struct Hex {
+  std::array<char, 3 * sizeof(void *) - 1> chars;
+
+  operator std::string_view() const { return {chars.data(), chars.size()}; }
+};
+
+Hex to_hex(const void *ptr) {
+  static const char digits[] = "0123456789abcdef";
   auto v = reinterpret_cast<uintptr_t>(ptr);
-  std::string res;
-  for (size_t i = 0; i < 2 * sizeof(void *); i++) {
-    if (i > 0 && i % 2 == 0) {
-      res.append(" ");
-    }
-    auto digit = v % 16;
-    switch (digit) {
-    case 10:
-      res.append("a");
-      break;
-    case 11:
-      res.append("b");
-      break;
-    case 12:
-      res.append("c");
-      break;
-    case 13:
-      res.append("d");
-      break;
-    case 14:
-      res.append("e");
-      break;
-    case 15:
-      res.append("f");
-      break;
-    default:
-      res.append(std::format("{}", digit));
-      break;
+  Hex res;
+  for (size_t i = 0; i < sizeof(void *); i++) {
+    auto byte = (v >> (8 * (sizeof(void *) - 1 - i))) & 0xff;
+    res.chars[3 * i] = digits[byte >> 4];
+    res.chars[3 * i + 1] = digits[byte & 0xf];
+    if (i + 1 < sizeof(void *)) {
+      res.chars[3 * i + 2] = ' ';
     }
-    v = v >> 4;
   }
-  std::reverse(res.begin(), res.end());
   return res;
 }
 
+std::string pointer_to_hex(void *ptr) { return std::string(to_hex(ptr)); }
+
+// formatted text in a fixed-size buffer (truncated if it doesn't fit)
+template <size_t N> struct Text {
+  std::array<char, N> chars;
+  size_t size;
+
+  operator std::string_view() const { return {chars.data(), size}; }
+};
+
+template <size_t N = 32, typename... Args>
+Text<N> text(std::format_string<Args...> fmt, Args &&...args) {
+  Text<N> res;
+  res.size = std::format_to_n(res.chars.data(), N, fmt,
+                              std::forward<Args>(args)...)
+                 .size;
+  res.size = std::min(res.size, N);
+  return res;
+}
+
+std::string ns_to_us(uint64_t ns) {
+  return std::format("{:13.1f} us", static_cast<double>(ns) / 1000);
+}
+
+bool transparent_huge_pages_enabled() {
+  // "always [madvise] never", the current mode in brackets
+  std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string modes;
+  return std::getline(in, modes) &&
+         modes.find("[never]") == std::string::npos;
+}
+
+// Reserves `bytes` (a multiple of the huge page size) aligned to huge pages,
+// `huge_pages` is set to the backing actually used.
+void *map_huge_pages(size_t bytes, HugePages &huge_pages) {
+  const size_t huge_page_size = MarkAndSweep::huge_page_size;
+  if (huge_pages == HugePages::EXPLICIT) {
+    // without MAP_NORESERVE, so that a pool too small for the whole heap is
+    // noticed here and not by SIGBUS on first touch
+    auto space =
+        mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT),
+             -1, 0);
+    if (space != MAP_FAILED) {
+      return space;
+    }
+    huge_pages = HugePages::TRANSPARENT;
+  }
+  // reserve one more huge page and cut the range down to an aligned one
+  auto reserved = bytes + huge_page_size;
+  auto space = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (space == MAP_FAILED) {
+    return space;
+  }
+  auto start = reinterpret_cast<uintptr_t>(space);
+  auto aligned = (start + huge_page_size - 1) & ~(huge_page_size - 1);
+  if (aligned > start) {
+    munmap(space, aligned - start);
+  }
+  munmap(reinterpret_cast<void *>(aligned + bytes),
+         start + reserved - aligned - bytes);
+  if (!transparent_huge_pages_enabled() ||
+      madvise(reinterpret_cast<void *>(aligned), bytes, MADV_HUGEPAGE) != 0) {
+    huge_pages = HugePages::NONE;
+  }
+  return reinterpret_cast<void *>(aligned);
+}
+
 MarkAndSweep::MarkAndSweep(size_t max_memory, bool merge_blocks,
-                           bool skip_first_field, bool incremental)
+                           bool skip_first_field, bool incremental,
+                           HugePages huge_pages, bool merged_header,
+                           bool compressed_refs)
     : max_memory(max_memory), merge_blocks(merge_blocks),
       skip_first_field(skip_first_field), incremental(incremental),
+      merged_header(merged_header), compressed_refs(compressed_refs),
       stats_(Stats{.n_blocks_used = 0,
-                   .n_blocks_free = 1,
-                   .n_blocks_total = 1,
+                   .n_blocks_free = 0,
+                   .n_blocks_total = 0,
                    .n_blocks_used_max = 0,
                    .bytes_used = 0,
-                   .bytes_free = max_memory,
+                   .bytes_free = 0,
                    .bytes_used_max = 0,
+                   .bytes_decommitted = 0,
+                   .n_large_objects = 0,
+                   .bytes_large_objects = 0,
                    .reads = 0,
                    .writes = 0,
                    .collections = 0,
                    .incremental_collections = 0,
-                   .collected_objects = std::vector<void *>()}) {
+                   .incremental_fallbacks = 0,
+                   .mark_ns = 0,
+                   .sweep_ns = 0,
+                   .decommit_ns = 0,
+                   .full_pauses = PauseHistogram(),
+                   .incremental_pauses = PauseHistogram(),
+                   .mmu = {}}),
+      huge_pages_(huge_pages),
+      page_size_(static_cast<size_t>(sysconf(_SC_PAGESIZE))) {
   log("create space");
-  space_ = std::make_unique<unsigned char[]>(max_memory);
+  // only reserved, pages are committed when touched
+  auto map_size = max_memory;
+  void *space;
+  if (huge_pages_ == HugePages::NONE) {
+    space = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  } else {
+    map_size = (max_memory + huge_page_size - 1) & ~(huge_page_size - 1);
+    space = map_huge_pages(map_size, huge_pages_);
+  }
+  if (space == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  if (huge_pages_ != HugePages::NONE) {
+    page_size_ = huge_page_size;
+  }
+  space_ = std::unique_ptr<unsigned char[], Unmap>(
+      static_cast<unsigned char *>(space), Unmap{map_size});
   space_start_ = space_.get();
   space_end_ = &space_[max_memory];
-  auto max_allowed_memory = static_cast<size_t>(1)
-                            << (8 * sizeof(block_size_t));
-  assert((max_memory < max_allowed_memory &&
-          "max memory must be less than max block size") ||
-         log(std::format("{} is >= {}", max_memory, max_allowed_memory)));
+  assert(max_memory % sizeof(pointer_t) == 0 &&
+         max_memory >= sizeof(Metadata) + sizeof(pointer_t) &&
+         "max memory must be aligned to pointer size and fit a block");
   assert(reinterpret_cast<uintptr_t>(space_start_) % sizeof(pointer_t) == 0 &&
          "space start address must be aligned to pointer size");
+  assert(!(merged_header && skip_first_field) &&
+         "the first field is the shared header word");
+  assert((!compressed_refs || merged_header) &&
+         "compressed fields start right after the shared header word");
+  assert((!compressed_refs || max_memory <= max_compressed_memory) &&
+         "heap is too large for compressed references");
 
-  log("create first block");
-  auto first_block_idx = sizeof(Metadata);
-  auto metadata = get_metadata(first_block_idx);
-  metadata->block_size = max_memory;
-  metadata->done = 0;
-  metadata->mark = FREE;
-
+  log("create first blocks");
+  auto last_link = create_free_blocks(0, &freelist_);
   log("init freelist");
-  *reinterpret_cast<void **>(&space_[first_block_idx]) = nullptr;
-  freelist_ = &space_[first_block_idx];
+  *last_link = nullptr;
+}
+
+void **MarkAndSweep::create_free_blocks(size_t start, void **last_link) {
+  // each at least the smallest block size
+  size_t block_start = start;
+  while (block_start < max_memory) {
+    auto block_size = std::min(max_memory - block_start, max_block_size);
+    auto rest = max_memory - block_start - block_size;
+    if (rest > 0 && rest < sizeof(Metadata) + sizeof(pointer_t)) {
+      block_size -= sizeof(Metadata) + sizeof(pointer_t);
+    }
+    auto block_idx = block_start + sizeof(Metadata);
+    // not validated, the memory may hold anything
+    auto metadata = reinterpret_cast<Metadata *>(&space_[block_start]);
+    metadata->block_size = block_size;
+    metadata->done = 0;
+    metadata->mark = FREE;
+    if (block_starts_) {
+      set_block_start(&space_[block_idx], true);
+    }
+    *last_link = &space_[block_idx];
+    last_link = reinterpret_cast<void **>(&space_[block_idx]);
+    stats_.n_blocks_free++;
+    stats_.n_blocks_total++;
+    stats_.bytes_free += block_size;
+    block_start += block_size;
+  }
+  return last_link;
+}
+
+void MarkAndSweep::Unmap::operator()(unsigned char *space) const {
+  munmap(space, size);
+}
+
+// mapping of a large object of `block_size` bytes (metadata included)
+size_t large_object_mapping_size(size_t block_size) {
+  static const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return (block_size + page_size - 1) & ~(page_size - 1);
+}
+
+MarkAndSweep::~MarkAndSweep() {
+  for (auto obj : large_objects_) {
+    auto meta = object_metadata(obj);
+    munmap(meta, large_object_mapping_size(meta->block_size));
+  }
+}
+
+Stats MarkAndSweep::get_stats() const {
+  auto stats = this->stats_;
+  stats.mmu = mutator_utilization_.get();
+  return stats;
+}
+
+size_t MarkAndSweep::bytes_used() const {
+  return stats_.bytes_used + stats_.bytes_large_objects;
+}
+
+size_t MarkAndSweep::bytes_free() const { return stats_.bytes_free; }
+
+HugePages MarkAndSweep::huge_pages() const { return huge_pages_; }
+
+MarkAndSweep::ref_t MarkAndSweep::compress(void *obj) const {
+  if (obj == nullptr) {
+    return 0;
+  }
+  assert(contains(obj));
+  auto offset = reinterpret_cast<uintptr_t>(obj) -
+                reinterpret_cast<uintptr_t>(space_start_);
+  return static_cast<ref_t>(offset / sizeof(pointer_t) + 1);
+}
+
+void *MarkAndSweep::decompress(ref_t ref) const {
+  if (ref == 0 || (ref & external_ref_bit)) {
+    return nullptr;
+  }
+  return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(space_start_) +
+                                  (ref - 1) * sizeof(pointer_t));
+}
+
+bool MarkAndSweep::contains(void const *obj) const {
+  return is_in_space(from_object(const_cast<void *>(obj)));
+}
+
+void MarkAndSweep::push_root(void **root) { push_root(roots_, root); }
+
+void MarkAndSweep::pop_root(void **root) { pop_root(roots_, root); }
+
+void MarkAndSweep::add_root_stack(RootStack *stack) {
+  root_stacks_.push_back(stack);
+  for (auto root : *stack) {
+    auto obj = from_object(*root);
+    if (incremental && is_heap_object(obj) && phase_ == MARK) {
+      mark_queue_.push(obj);
+    }
+  }
+}
+
+void MarkAndSweep::remove_root_stack(RootStack *stack) {
+  auto it = std::find(root_stacks_.begin(), root_stacks_.end(), stack);
+  assert(it != root_stacks_.end() && "root stack is not registered");
+  root_stacks_.erase(it);
+}
+
+template <typename F> void MarkAndSweep::for_each_root(F f) const {
+  for (auto root : roots_) {
+    f(root);
+  }
+  for (auto stack : root_stacks_) {
+    for (auto root : *stack) {
+      f(root);
+    }
+  }
+  for (auto &root : conservative_roots_) {
+    f(const_cast<void **>(&root));
+  }
+}
+
+size_t MarkAndSweep::n_roots() const {
+  auto n = roots_.size() + conservative_roots_.size();
+  for (auto stack : root_stacks_) {
+    n += stack->size();
+  }
+  return n;
+}
+
+void MarkAndSweep::enable_conservative_roots() {
+  if (block_starts_) {
+    return;
+  }
+  log("enable conservative roots");
+  // only reserved, like the heap
+  auto map_size = (max_memory / sizeof(pointer_t) + 7) / 8;
+  auto map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  block_starts_ = std::unique_ptr<unsigned char[], Unmap>(
+      static_cast<unsigned char *>(map), Unmap{map_size});
+  auto p = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(space_start_) +
+                                    sizeof(Metadata));
+  while (p < space_end_) {
+    set_block_start(p, true);
+    auto block_idx = pointer_to_idx(p);
+    p = reinterpret_cast<void *>(
+        &space_[block_idx + get_metadata(block_idx)->block_size]);
+  }
+}
+
+// stacks are read word by word, including words the sanitizer considers
+// poisoned (redzones of locals)
+__attribute__((no_sanitize_address)) void
+MarkAndSweep::scan_conservative_roots(const std::vector<MemoryRange> &ranges) {
+  assert(block_starts_ && "conservative roots are not enabled");
+  conservative_roots_.clear();
+  for (auto range : ranges) {
+    auto begin = (reinterpret_cast<uintptr_t>(range.begin) +
+                  sizeof(pointer_t) - 1) &
+                 ~(sizeof(pointer_t) - 1);
+    auto end = reinterpret_cast<uintptr_t>(range.end);
+    for (auto word = begin; word + sizeof(pointer_t) <= end;
+         word += sizeof(pointer_t)) {
+      auto candidate = *reinterpret_cast<void *const *>(word);
+      if (is_object_pointer(candidate)) {
+        conservative_roots_.push_back(candidate);
+      }
+    }
+  }
+  std::sort(conservative_roots_.begin(), conservative_roots_.end());
+  conservative_roots_.erase(
+      std::unique(conservative_roots_.begin(), conservative_roots_.end()),
+      conservative_roots_.end());
+}
+
+void MarkAndSweep::clear_conservative_roots() { conservative_roots_.clear(); }
+
+void MarkAndSweep::set_block_start(unsigned char *block_starts,
+                                   const unsigned char *space_start,
+                                   const void *block, bool start) {
+  auto word =
+      static_cast<size_t>(static_cast<const unsigned char *>(block) -
+                          space_start) /
+      sizeof(pointer_t);
+  // buffers of different threads can share a byte
+  std::atomic_ref<unsigned char> byte(block_starts[word / 8]);
+  auto bit = static_cast<unsigned char>(1u << (word % 8));
+  if (start) {
+    byte.fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    byte.fetch_and(static_cast<unsigned char>(~bit),
+                   std::memory_order_relaxed);
+  }
 }
 
-Stats MarkAndSweep::get_stats() const { return this->stats_; }
+void MarkAndSweep::set_block_start(const void *block, bool start) {
+  set_block_start(block_starts_.get(), space_.get(), block, start);
+}
+
+bool MarkAndSweep::is_block_start(const void *block) const {
+  auto word = pointer_to_idx(block) / sizeof(pointer_t);
+  return (block_starts_[word / 8] >> (word % 8)) & 1;
+}
 
-void MarkAndSweep::push_root(void **root) {
-  this->roots_.push_back(root);
-  if (incremental && is_in_space(*root)) {
+bool MarkAndSweep::is_object_pointer(void const *word) const {
+  auto x = from_object(const_cast<void *>(word));
+  if (is_in_space(x)) {
+    return reinterpret_cast<uintptr_t>(x) % sizeof(pointer_t) == 0 &&
+           is_block_start(x) && object_metadata(x)->mark != FREE;
+  }
+  return is_large_object(x);
+}
+
+void MarkAndSweep::push_root(RootStack &stack, void **root) {
+  stack.push_back(root);
+  auto obj = from_object(*root);
+  if (incremental && is_heap_object(obj)) {
     if (phase_ == MARK) {
-      mark_queue_.push(*root);
-    } else if (phase_ == SWEEP && resume_sweep_from <= *root) {
-      auto block_idx = pointer_to_idx(*root);
+      mark_queue_.push(obj);
+    } else if (phase_ == SWEEP && is_in_space(obj) &&
+               resume_sweep_from <= obj) {
+      // large objects are all swept at the start of the phase
+      auto block_idx = pointer_to_idx(obj);
       auto block_meta = get_metadata(block_idx);
       block_meta->mark = MARKED;
     }
   }
 }
 
-void MarkAndSweep::pop_root(void **root) {
-  assert(this->roots_.size() > 0 && "roots must not be empty when poping root");
-  assert(this->roots_.back() == root &&
-         "the root must be at the top of the stack");
-  this->roots_.pop_back();
+void MarkAndSweep::pop_root(RootStack &stack, [[maybe_unused]] void **root) {
+  assert(stack.size() > 0 && "roots must not be empty when poping root");
+  assert(stack.back() == root && "the root must be at the top of the stack");
+  stack.pop_back();
 }
 
-void *MarkAndSweep::allocate(std::size_t bytes) {
-  assert(bytes > 0 && "can't allocate 0 bytes");
-  // BLOCK STRUCTURE
-  // everything aligned to pointer size (void*)
-  //
-  //                      -1 | metadata
-  // object pointer   -->  0 | field
-  //                       1 | ...
-  auto allocate_at_least = sizeof(Metadata) + bytes;
+size_t MarkAndSweep::block_size_for(std::size_t bytes, bool merged_header) {
+  // the object's first word is the metadata, but a block must fit the link
+  // to the next free block
+  auto allocate_at_least =
+      merged_header ? std::max(bytes, sizeof(Metadata) + sizeof(pointer_t))
+                    : sizeof(Metadata) + bytes;
   auto to_allocate = allocate_at_least;
   auto offset = to_allocate % sizeof(pointer_t);
   if (offset) {
@@ -135,11 +438,88 @@ void *MarkAndSweep::allocate(std::size_t bytes) {
          "object address must be aligned to pointer size");
   assert(allocate_at_least <= to_allocate &&
          "allocated memory must fit all object fields and metadata");
+  return to_allocate;
+}
+
+void *MarkAndSweep::allocate(std::size_t bytes) {
+  assert(bytes > 0 && "can't allocate 0 bytes");
+  // BLOCK STRUCTURE
+  // everything aligned to pointer size (void*)
+  //
+  //                      -1 | metadata
+  // object pointer   -->  0 | field
+  //                       1 | ...
+  //
+  // with merged headers the object pointer points at the metadata
+  auto to_allocate = block_size_for(bytes, merged_header);
+  if (to_allocate > max_block_size) {
+    return nullptr;
+  }
 
   if (incremental) {
-    incr_collect(bytes_to_free_per_alloc_ * to_allocate);
+    // work is done in steps of at least incr_min_step_ bytes, so that small
+    // allocations don't pay for timing a step each
+    incr_debt_ += bytes_to_free_per_alloc_ * to_allocate;
+    if (incr_debt_ >= incr_min_step_) {
+      incr_collect(std::exchange(incr_debt_, 0));
+    }
+  }
+  if (large_object_threshold_ > 0 && bytes >= large_object_threshold_) {
+    return to_object(allocate_large(to_allocate));
+  }
+  auto obj = allocate_block(to_allocate);
+  if (compressed_refs && obj) {
+    // an odd number of references leaves half of the last word unused, it
+    // must not hold a stale reference
+    static_cast<void **>(obj)[to_allocate / sizeof(pointer_t) - 2] = nullptr;
+  }
+  return to_object(obj);
+}
+
+void *MarkAndSweep::to_object(void *internal) const {
+  if (!merged_header || internal == nullptr) {
+    return internal;
+  }
+  return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(internal) -
+                                  sizeof(Metadata));
+}
+
+void *MarkAndSweep::from_object(void *obj) const {
+  if (!merged_header || obj == nullptr) {
+    return obj;
   }
+  return reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(obj) +
+                                  sizeof(Metadata));
+}
+
+size_t MarkAndSweep::field_count(Metadata const *meta) const {
+  auto obj_size = meta->block_size - sizeof(Metadata);
+  assert(obj_size % sizeof(pointer_t) == 0);
+  return obj_size / (compressed_refs ? sizeof(ref_t) : sizeof(pointer_t));
+}
 
+void *MarkAndSweep::load_field(void *x, size_t i) const {
+  if (compressed_refs) {
+    return decompress(static_cast<ref_t *>(x)[i]);
+  }
+  return static_cast<void **>(x)[i];
+}
+
+void MarkAndSweep::store_field(void *x, size_t i, void *value) const {
+  if (compressed_refs) {
+    static_cast<ref_t *>(x)[i] = compress(value);
+  } else {
+    static_cast<void **>(x)[i] = value;
+  }
+}
+
+void *MarkAndSweep::allocate_block(std::size_t to_allocate) {
+  if (stats_.bytes_large_objects > 0 &&
+      stats_.bytes_used + stats_.bytes_large_objects + to_allocate >
+          max_memory) {
+    log("out of memory (large objects)");
+    return nullptr;
+  }
   void **prev_free_block = &freelist_;
   void *free_block = freelist_;
   log("allocate");
@@ -149,7 +529,7 @@ void *MarkAndSweep::allocate(std::size_t bytes) {
     assert(block_meta->mark == FREE);
     if (block_meta->block_size == to_allocate) {
       // update meta
-      block_meta->done = 0;
+      recommit(block_meta);
       block_meta->mark = NOT_MARKED;
       if (incremental && phase_ == SWEEP && resume_sweep_from <= free_block) {
         block_meta->mark = MARKED;
@@ -173,18 +553,28 @@ void *MarkAndSweep::allocate(std::size_t bytes) {
                block_meta->block_size - to_allocate >=
                    sizeof(Metadata) + sizeof(pointer_t)) {
       // take required space and split remaining into new block
+      auto decommitted = block_meta->done == DECOMMITTED;
+      recommit(block_meta);
       auto new_block_idx = block_idx + to_allocate;
       auto new_block_meta = reinterpret_cast<Metadata *>(
           &space_[new_block_idx - sizeof(Metadata)]);
       new_block_meta->block_size = block_meta->block_size - to_allocate;
       new_block_meta->done = 0;
       new_block_meta->mark = FREE;
+      if (decommitted) {
+        // the rest of its pages are still returned
+        auto [from, to] = decommit_range(new_block_meta);
+        stats_.bytes_decommitted += to - from;
+        new_block_meta->done = DECOMMITTED;
+      }
+      if (block_starts_) {
+        set_block_start(&space_[new_block_idx], true);
+      }
       // save next free block
       *reinterpret_cast<void **>(&space_[new_block_idx]) =
           *reinterpret_cast<void **>(&space_[block_idx]);
       // update meta
       block_meta->block_size = to_allocate;
-      block_meta->done = 0;
       block_meta->mark = NOT_MARKED;
       if (incremental && phase_ == SWEEP && resume_sweep_from <= free_block) {
         block_meta->mark = MARKED;
@@ -207,7 +597,7 @@ void *MarkAndSweep::allocate(std::size_t bytes) {
     } else if (block_meta->block_size > to_allocate) {
       // can't split block, fill entire block instead
       // update meta
-      block_meta->done = 0;
+      recommit(block_meta);
       block_meta->mark = NOT_MARKED;
       if (incremental && phase_ == SWEEP && resume_sweep_from <= free_block) {
         block_meta->mark = MARKED;
@@ -243,31 +633,226 @@ void *MarkAndSweep::allocate(std::size_t bytes) {
   return nullptr;
 }
 
+void *MarkAndSweep::allocate_large(std::size_t block_size) {
+  log("allocate large object");
+  auto mapping_size = large_object_mapping_size(block_size);
+  if (stats_.bytes_used + stats_.bytes_large_objects + mapping_size >
+      max_memory) {
+    return nullptr;
+  }
+  // zeroed by the OS
+  auto mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+  auto meta = static_cast<Metadata *>(mapping);
+  meta->block_size = block_size;
+  meta->done = 0;
+  // unmarked even while sweeping, large objects are swept at its start
+  meta->mark = NOT_MARKED;
+  auto obj = reinterpret_cast<void *>(meta + 1);
+  large_objects_.insert(obj);
+  stats_.n_large_objects++;
+  stats_.bytes_large_objects += mapping_size;
+  return obj;
+}
+
+bool MarkAndSweep::refill_tlab(Tlab &tlab, std::size_t bytes) {
+  assert(!incremental && "buffers are not supported in incremental mode");
+  assert(tlab.start == nullptr && "retire the buffer before refilling it");
+  assert(bytes > sizeof(Metadata));
+  log("refill tlab");
+  auto block = allocate_block(block_size_for(bytes - sizeof(Metadata), false));
+  if (!block) {
+    return false;
+  }
+  auto block_idx = pointer_to_idx(block);
+  tlab.start = &space_[block_idx - sizeof(Metadata)];
+  tlab.top = tlab.start;
+  tlab.end = tlab.start + get_metadata(block_idx)->block_size;
+  tlab.n_objects = 0;
+  tlab.merged_header = merged_header;
+  tlab.compressed_refs = compressed_refs;
+  tlab.block_starts = block_starts_.get();
+  tlab.space_start = space_.get();
+  return true;
+}
+
+void *MarkAndSweep::allocate_in_tlab(Tlab &tlab, std::size_t bytes) {
+  assert(bytes > 0 && "can't allocate 0 bytes");
+  auto to_allocate = block_size_for(bytes, tlab.merged_header);
+  if (to_allocate > static_cast<size_t>(tlab.end - tlab.top)) {
+    return nullptr;
+  }
+  if (tlab.compressed_refs) {
+    // see allocate
+    *reinterpret_cast<void **>(tlab.top + to_allocate - sizeof(pointer_t)) =
+        nullptr;
+  }
+  // a tail too small for a block is given to this object
+  auto rest = static_cast<size_t>(tlab.end - tlab.top) - to_allocate;
+  if (rest > 0 && rest < sizeof(Metadata) + sizeof(pointer_t)) {
+    // zero it, it can contain invalid pointers
+    assert(rest == sizeof(pointer_t));
+    *reinterpret_cast<void **>(tlab.top + to_allocate) = nullptr;
+    to_allocate += rest;
+  }
+  auto meta = reinterpret_cast<Metadata *>(tlab.top);
+  meta->block_size = to_allocate;
+  meta->done = 0;
+  meta->mark = NOT_MARKED;
+  if (tlab.block_starts) {
+    set_block_start(tlab.block_starts, tlab.space_start,
+                    tlab.top + sizeof(Metadata), true);
+  }
+  auto obj = tlab.merged_header ? tlab.top : tlab.top + sizeof(Metadata);
+  tlab.top += to_allocate;
+  tlab.n_objects++;
+  return obj;
+}
+
+void MarkAndSweep::retire_tlab(Tlab &tlab) {
+  if (tlab.start == nullptr) {
+    return;
+  }
+  log("retire tlab");
+  // the buffer was counted as one used block when taken
+  auto tail = static_cast<size_t>(tlab.end - tlab.top);
+  stats_.n_blocks_used += tlab.n_objects;
+  stats_.n_blocks_used--;
+  stats_.n_blocks_used_max =
+      std::max(stats_.n_blocks_used_max, stats_.n_blocks_used);
+  stats_.n_blocks_total += tlab.n_objects;
+  stats_.n_blocks_total--;
+  if (tail > 0) {
+    assert(tail >= sizeof(Metadata) + sizeof(pointer_t));
+    auto meta = reinterpret_cast<Metadata *>(tlab.top);
+    meta->block_size = tail;
+    meta->done = 0;
+    meta->mark = FREE;
+    auto block = tlab.top + sizeof(Metadata);
+    if (block_starts_) {
+      set_block_start(block, true);
+    }
+    *reinterpret_cast<void **>(block) = freelist_;
+    freelist_ = block;
+    stats_.n_blocks_total++;
+    stats_.n_blocks_free++;
+    stats_.bytes_used -= tail;
+    stats_.bytes_free += tail;
+  }
+  tlab = Tlab{};
+}
+
 void MarkAndSweep::collect() {
   log("collect");
+  if (incremental) {
+    auto start = clock::now();
+    // objects that died while the current cycle was marking survive it
+    complete_cycle();
+    complete_cycle();
+    auto end = clock::now();
+    stats_.full_pauses.record(elapsed_ns(start, end));
+    mutator_utilization_.record(start, end);
+    return;
+  }
   stats_.collections++;
+  auto start = clock::now();
   mark();
+  auto marked = clock::now();
+  // also merges blocks
   sweep();
-  if (merge_blocks) {
-    merge();
-  }
+  auto swept = clock::now();
+  decommit();
+  auto end = clock::now();
+  stats_.mark_ns += elapsed_ns(start, marked);
+  stats_.sweep_ns += elapsed_ns(marked, swept);
+  stats_.decommit_ns += elapsed_ns(swept, end);
+  stats_.full_pauses.record(elapsed_ns(start, end));
+  mutator_utilization_.record(start, end);
 }
 
 void MarkAndSweep::mark() {
   log("mark");
-  for (auto root : roots_) {
-    auto x = *root;
-    if (!is_in_space(x)) {
-      continue;
+  for_each_root([this](void **root) {
+    auto x = from_object(*root);
+    // most pointers are into the space, large objects are looked up last
+    if (is_in_space(x)) {
+      if (get_metadata(pointer_to_idx(x))->mark == NOT_MARKED) {
+        mark_from(x);
+      }
+    } else if (is_large_object(x)) {
+      mark_large(x);
     }
-    auto x_i = pointer_to_idx(x);
-    auto x_meta = get_metadata(x_i);
-    if (x_meta->mark == NOT_MARKED) {
-      dfs(x);
+  });
+  // fields of large objects are scanned here, not by dfs (they can have
+  // more fields than `done` can count)
+  while (!large_mark_stack_.empty()) {
+    auto x = large_mark_stack_.back();
+    large_mark_stack_.pop_back();
+    auto field_n = field_count(object_metadata(x));
+    for (size_t i = skip_first_field ? 1 : 0; i < field_n; i++) {
+      auto y = from_object(load_field(x, i));
+      if (is_in_space(y)) {
+        if (get_metadata(pointer_to_idx(y))->mark == NOT_MARKED) {
+          mark_from(y);
+        }
+      } else if (is_large_object(y)) {
+        mark_large(y);
+      }
     }
   }
 }
 
+void MarkAndSweep::mark_from(void *x) {
+  if (mark_strategy_ == MarkStrategy::POINTER_REVERSAL) {
+    dfs(x);
+    return;
+  }
+  get_metadata(pointer_to_idx(x))->mark = MARKED;
+  mark_stack_.push_back(x);
+  while (!mark_stack_.empty()) {
+    x = mark_stack_.back();
+    mark_stack_.pop_back();
+    auto field_n = field_count(get_metadata(pointer_to_idx(x)));
+    for (size_t i = skip_first_field ? 1 : 0; i < field_n; i++) {
+      auto y = from_object(load_field(x, i));
+      if (is_in_space(y)) {
+        auto y_meta = get_metadata(pointer_to_idx(y));
+        if (y_meta->mark != NOT_MARKED) {
+          continue;
+        }
+        if (mark_stack_.size() < max_mark_stack_) {
+          y_meta->mark = MARKED;
+          mark_stack_.push_back(y);
+        } else {
+          // overflow, marked without extra memory
+          dfs(y);
+        }
+      } else if (is_large_object(y)) {
+        mark_large(y);
+      }
+    }
+  }
+}
+
+void MarkAndSweep::set_mark_strategy(MarkStrategy strategy,
+                                     size_t max_stack) {
+  assert(max_stack > 0);
+  mark_strategy_ = strategy;
+  max_mark_stack_ = max_stack;
+  mark_stack_.shrink_to_fit();
+}
+
+void MarkAndSweep::mark_large(void *x) {
+  auto x_meta = object_metadata(x);
+  if (x_meta->mark == NOT_MARKED) {
+    x_meta->mark = MARKED;
+    large_mark_stack_.push_back(x);
+  }
+}
+
 void MarkAndSweep::dfs(void *x) {
   auto x_i = pointer_to_idx(x);
   auto x_meta = get_metadata(x_i);
@@ -278,24 +863,23 @@ void MarkAndSweep::dfs(void *x) {
     x_i = pointer_to_idx(x);
     x_meta = get_metadata(x_i);
     auto i = x_meta->done;
-    auto obj_size = x_meta->block_size - sizeof(Metadata);
-    assert(obj_size % sizeof(pointer_t) == 0);
-    auto field_n = obj_size / sizeof(pointer_t);
+    auto field_n = field_count(x_meta);
     if (i < field_n) {
       if (i > 0 || !skip_first_field) {
-        auto field_i_addr = &space_[x_i + i * sizeof(pointer_t)];
-        auto y = *reinterpret_cast<void **>(field_i_addr);
+        auto y = from_object(load_field(x, i));
         if (is_in_space(y)) {
           auto y_i = pointer_to_idx(y);
           auto y_meta = get_metadata(y_i);
           if (y_meta->mark == NOT_MARKED) {
-            *reinterpret_cast<void **>(field_i_addr) = tmp;
+            store_field(x, i, to_object(tmp));
             tmp = x;
             x = y;
             y_meta->mark = MARKED;
             y_meta->done = 0;
             continue;
           }
+        } else if (is_large_object(y)) {
+          mark_large(y);
         }
       }
       x_meta->done++;
@@ -305,12 +889,10 @@ void MarkAndSweep::dfs(void *x) {
       if (!x) {
         return;
       }
-      x_i = pointer_to_idx(x);
-      x_meta = get_metadata(x_i);
+      x_meta = get_metadata(pointer_to_idx(x));
       auto i = x_meta->done;
-      auto field_i_addr = &space_[x_i + i * sizeof(pointer_t)];
-      tmp = *reinterpret_cast<void **>(field_i_addr);
-      *reinterpret_cast<void **>(field_i_addr) = y;
+      tmp = from_object(load_field(x, i));
+      store_field(x, i, to_object(y));
       x_meta->done++;
     }
   }
@@ -318,28 +900,135 @@ void MarkAndSweep::dfs(void *x) {
 
 void MarkAndSweep::sweep() {
   log("sweep");
-  stats_.collected_objects.clear();
+  if (sweep_observer_) {
+    sweep_observer_->sweep_started();
+  }
+  // with merge_blocks, free blocks are merged in the same pass and the
+  // freelist is rebuilt (see coalesce)
+  if (merge_blocks) {
+    freelist_ = nullptr;
+  }
+  start_census();
+  auto census = census_enabled_;
+  Metadata *merging_meta = nullptr;
+  // counted locally, stats_ would be reloaded after every write to the heap
+  size_t n_freed = 0;
+  size_t bytes_freed = 0;
+  size_t n_merged = 0;
   auto p = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(space_start_) +
                                     sizeof(Metadata));
   while (p < space_end_) {
     auto block_idx = pointer_to_idx(p);
     auto block_meta = get_metadata(block_idx);
+    auto block_size = block_meta->block_size;
     if (block_meta->mark == MARKED) {
       block_meta->mark = NOT_MARKED;
-    } else if (block_meta->mark == NOT_MARKED) {
-      block_meta->mark = FREE;
-      *reinterpret_cast<void **>(p) = freelist_;
-      freelist_ = p;
-      assert(stats_.n_blocks_used > 0);
-      assert(stats_.bytes_used >= block_meta->block_size);
-      stats_.collected_objects.push_back(p);
-      stats_.n_blocks_used--;
-      stats_.n_blocks_free++;
-      stats_.bytes_used -= block_meta->block_size;
-      stats_.bytes_free += block_meta->block_size;
+      merging_meta = nullptr;
+      if (census) {
+        count_live(p, block_size);
+      }
+    } else if (block_meta->mark == NOT_MARKED || merge_blocks) {
+      if (block_meta->mark == NOT_MARKED) {
+        if (sweep_observer_) {
+          sweep_observer_->collected(to_object(p));
+        }
+        block_meta->mark = FREE;
+        block_meta->done = 0;
+        n_freed++;
+        bytes_freed += block_size;
+      }
+      n_merged += coalesce(p, block_meta, merging_meta);
+      if (!merge_blocks) {
+        merging_meta = nullptr;
+      }
     }
-    p = reinterpret_cast<void *>(&space_[block_idx + block_meta->block_size]);
+    p = reinterpret_cast<void *>(&space_[block_idx + block_size]);
   }
+  assert(stats_.n_blocks_used >= n_freed);
+  assert(stats_.bytes_used >= bytes_freed);
+  stats_.n_blocks_used -= n_freed;
+  stats_.n_blocks_free += n_freed;
+  stats_.n_blocks_free -= n_merged;
+  stats_.n_blocks_total -= n_merged;
+  stats_.bytes_used -= bytes_freed;
+  stats_.bytes_free += bytes_freed;
+  sweep_large_objects();
+  finish_census();
+}
+
+void MarkAndSweep::sweep_large_objects() {
+  for (auto it = large_objects_.begin(); it != large_objects_.end();) {
+    auto obj = *it;
+    auto meta = object_metadata(obj);
+    if (meta->mark == MARKED) {
+      meta->mark = NOT_MARKED;
+      if (census_enabled_) {
+        count_live(obj, meta->block_size);
+      }
+      ++it;
+      continue;
+    }
+    if (sweep_observer_) {
+      sweep_observer_->collected(to_object(obj));
+    }
+    auto mapping_size = large_object_mapping_size(meta->block_size);
+    munmap(meta, mapping_size);
+    it = large_objects_.erase(it);
+    stats_.n_large_objects--;
+    stats_.bytes_large_objects -= mapping_size;
+  }
+}
+
+void MarkAndSweep::set_sweep_observer(SweepObserver *observer) {
+  sweep_observer_ = observer;
+}
+
+void MarkAndSweep::set_census(bool enabled, uint8_t kind_mask,
+                              size_t history_every) {
+  census_enabled_ = enabled;
+  census_kind_mask_ = kind_mask;
+  census_history_every_ = history_every;
+  last_census_ = Census{};
+  census_history_.clear();
+  // an incremental sweep may be in progress
+  start_census();
+}
+
+void MarkAndSweep::start_census() {
+  if (!census_enabled_) {
+    return;
+  }
+  census_.by_kind.assign(census_kind_mask_ + 1, CensusEntry{});
+  census_.by_size.assign(census_max_words + 1, CensusEntry{});
+}
+
+void MarkAndSweep::count_live(void *x, size_t block_size) {
+  auto kind = *static_cast<const uint8_t *>(to_object(x)) & census_kind_mask_;
+  auto &by_kind = census_.by_kind[kind];
+  by_kind.objects++;
+  by_kind.bytes += block_size;
+  auto words = std::min(block_size / sizeof(pointer_t), census_max_words);
+  auto &by_size = census_.by_size[words];
+  by_size.objects++;
+  by_size.bytes += block_size;
+}
+
+void MarkAndSweep::finish_census() {
+  if (!census_enabled_) {
+    return;
+  }
+  census_.collection = stats_.collections + stats_.incremental_collections;
+  if (census_history_every_ > 0 &&
+      census_.collection % census_history_every_ == 0) {
+    census_history_.push_back(census_);
+  }
+  std::swap(last_census_, census_);
+}
+
+void MarkAndSweep::set_large_object_threshold(size_t bytes) {
+  assert((!compressed_refs || bytes == 0) &&
+         "large objects can't be referenced by compressed references");
+  large_object_threshold_ = bytes;
 }
 
 void MarkAndSweep::merge() {
@@ -347,29 +1036,83 @@ void MarkAndSweep::merge() {
   auto p = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(space_start_) +
                                     sizeof(Metadata));
   freelist_ = nullptr;
-  void *merging_block = nullptr;
+  Metadata *merging_meta = nullptr;
   while (p < space_end_) {
     auto block_idx = pointer_to_idx(p);
     auto block_meta = get_metadata(block_idx);
-    if (block_meta->mark == FREE) {
-      if (merging_block) {
-        auto merge_idx = pointer_to_idx(merging_block);
-        auto merge_meta = get_metadata(merge_idx);
-        merge_meta->block_size += block_meta->block_size;
-        stats_.n_blocks_total--;
-        stats_.n_blocks_free--;
-      } else {
-        *reinterpret_cast<void **>(p) = freelist_;
-        freelist_ = p;
-        merging_block = p;
-      }
-    } else {
-      merging_block = nullptr;
+    if (block_meta->mark != FREE) {
+      merging_meta = nullptr;
+    } else if (coalesce(p, block_meta, merging_meta)) {
+      stats_.n_blocks_total--;
+      stats_.n_blocks_free--;
     }
     p = reinterpret_cast<void *>(&space_[block_idx + block_meta->block_size]);
   }
 }
 
+bool MarkAndSweep::coalesce(void *x, Metadata *meta, Metadata *&merging) {
+  if (merging && merging->block_size <= max_block_size - meta->block_size) {
+    // pages of both are returned again by the next decommit()
+    recommit(meta);
+    recommit(merging);
+    merging->block_size += meta->block_size;
+    if (block_starts_) {
+      set_block_start(x, false);
+    }
+    return true;
+  }
+  *reinterpret_cast<void **>(x) = freelist_;
+  freelist_ = x;
+  merging = meta;
+  return false;
+}
+
+void MarkAndSweep::set_decommit(size_t min_block_size, bool lazy) {
+  decommit_min_block_size_ = min_block_size;
+  decommit_lazy_ = lazy;
+}
+
+void MarkAndSweep::decommit() {
+  if (decommit_min_block_size_ == 0) {
+    return;
+  }
+  for (auto p = freelist_; p; p = *reinterpret_cast<void **>(p)) {
+    auto meta = get_metadata(pointer_to_idx(p));
+    if (meta->block_size < decommit_min_block_size_ ||
+        meta->done == DECOMMITTED) {
+      continue;
+    }
+    auto [from, to] = decommit_range(meta);
+    if (from < to &&
+        madvise(reinterpret_cast<void *>(from), to - from,
+                decommit_lazy_ ? MADV_FREE : MADV_DONTNEED) != 0) {
+      // tried again after the next collection
+      continue;
+    }
+    stats_.bytes_decommitted += to - from;
+    meta->done = DECOMMITTED;
+  }
+}
+
+std::pair<uintptr_t, uintptr_t>
+MarkAndSweep::decommit_range(const Metadata *meta) const {
+  auto page_size = static_cast<uintptr_t>(page_size_);
+  // metadata and the link to the next free block stay committed
+  auto block = reinterpret_cast<uintptr_t>(meta + 1);
+  auto from = (block + sizeof(pointer_t) + page_size - 1) & ~(page_size - 1);
+  auto to = (block - sizeof(Metadata) + meta->block_size) & ~(page_size - 1);
+  return {from, std::max(from, to)};
+}
+
+void MarkAndSweep::recommit(Metadata *meta) {
+  if (meta->done == DECOMMITTED) {
+    auto [from, to] = decommit_range(meta);
+    assert(stats_.bytes_decommitted >= to - from);
+    stats_.bytes_decommitted -= to - from;
+  }
+  meta->done = 0;
+}
+
 const std::vector<void **> &MarkAndSweep::get_roots() const {
   return this->roots_;
 }
@@ -381,6 +1124,15 @@ bool MarkAndSweep::is_in_space(void const *obj) const {
              reinterpret_cast<uintptr_t>(space_end_);
 }
 
+bool MarkAndSweep::is_large_object(void const *obj) const {
+  return !large_objects_.empty() &&
+         large_objects_.contains(const_cast<void *>(obj));
+}
+
+bool MarkAndSweep::is_heap_object(void const *obj) const {
+  return is_in_space(obj) || is_large_object(obj);
+}
+
 bool MarkAndSweep::is_valid_free_block(void const *obj) const {
   if (obj == nullptr) {
     return true;
@@ -416,26 +1168,41 @@ MarkAndSweep::Metadata *MarkAndSweep::get_metadata(size_t obj_idx) const {
   return res;
 }
 
+MarkAndSweep::Metadata *MarkAndSweep::object_metadata(void const *obj) const {
+  if (is_in_space(obj)) {
+    return get_metadata(pointer_to_idx(obj));
+  }
+  assert(is_large_object(obj));
+  return reinterpret_cast<Metadata *>(reinterpret_cast<uintptr_t>(obj) -
+                                      sizeof(Metadata));
+}
+
 void MarkAndSweep::read(void *obj) {
   stats_.reads++;
+  obj = from_object(obj);
   if (is_in_space(obj)) {
     auto idx = pointer_to_idx(obj);
-    auto meta = get_metadata(idx);
+    [[maybe_unused]] auto meta = get_metadata(idx);
     assert((meta->mark != FREE && "tried to access unexisting object") ||
            log(pointer_to_hex(obj)));
   }
 }
 
+void MarkAndSweep::count_accesses(size_t reads, size_t writes) {
+  stats_.reads += reads;
+  stats_.writes += writes;
+}
+
 void MarkAndSweep::write(void *obj, void *contents) {
   stats_.writes++;
-  if (is_in_space(obj) && is_in_space(contents)) {
-    auto obj_idx = pointer_to_idx(obj);
-    auto obj_meta = get_metadata(obj_idx);
+  obj = from_object(obj);
+  contents = from_object(contents);
+  if (is_heap_object(obj) && is_heap_object(contents)) {
+    auto obj_meta = object_metadata(obj);
     assert((obj_meta->mark != FREE && "tried to access unexisting object") ||
            log(pointer_to_hex(obj)));
     if (incremental && phase_ == MARK && obj_meta->mark == MARKED) {
-      auto contents_idx = pointer_to_idx(contents);
-      auto contents_meta = get_metadata(contents_idx);
+      auto contents_meta = object_metadata(contents);
       if (contents_meta->mark == NOT_MARKED) {
         mark_queue_.push(contents);
       }
@@ -444,22 +1211,49 @@ void MarkAndSweep::write(void *obj, void *contents) {
 }
 
 std::string MarkAndSweep::dump() const {
-  std::string dump;
-  dump.append(dump_stats() + "\n\n");
-  dump.append(dump_roots() + "\n\n");
-  dump.append(dump_blocks() + "\n");
-  return dump;
+  std::ostringstream out;
+  dump(out);
+  return out.str();
 }
 
 std::string MarkAndSweep::dump_stats() const {
-  std::string dump;
-  dump.append("STATS\n");
-  tables::Table stats({26, 16, 17});
+  std::ostringstream out;
+  dump_stats(out);
+  return out.str();
+}
+
+std::string MarkAndSweep::dump_roots() const {
+  std::ostringstream out;
+  dump_roots(out);
+  return out.str();
+}
+
+std::string MarkAndSweep::dump_blocks() const {
+  std::ostringstream out;
+  dump_blocks(out);
+  return out.str();
+}
+
+void MarkAndSweep::dump(std::ostream &out, DumpOptions options) const {
+  dump_stats(out);
+  out << "\n\n";
+  dump_roots(out);
+  out << "\n\n";
+  dump_blocks(out, options);
+  out << "\n";
+}
+
+void MarkAndSweep::dump_stats(std::ostream &out) const {
+  out << "STATS\n";
+  tables::Table stats({26, 16, 17}, out);
   stats.separator();
   if (incremental) {
     stats.add_row(
         {"COLLECTIONS (incremental)", "",
          std::format("{:10} cycles", stats_.incremental_collections)});
+    stats.add_row(
+        {"COLLECTIONS (fallback)", "",
+         std::format("{:10} cycles", stats_.incremental_fallbacks)});
   } else {
     stats.add_row({"COLLECTIONS (full)", "",
                    std::format("{:10} cycles", stats_.collections)});
@@ -483,36 +1277,108 @@ std::string MarkAndSweep::dump_stats() const {
        std::format("{:10} bytes",
                    stats_.bytes_free - stats_.n_blocks_free * sizeof(Metadata)),
        ""});
+  if (decommit_min_block_size_ > 0) {
+    stats.add_row({"MEMORY RETURNED TO OS",
+                   std::format("{:10} bytes", stats_.bytes_decommitted), ""});
+  }
+  if (large_object_threshold_ > 0) {
+    stats.add_row({"LARGE OBJECTS",
+                   std::format("{:10} bytes", stats_.bytes_large_objects),
+                   std::format("{:10} objects", stats_.n_large_objects)});
+  }
   stats.separator();
   stats.add_row({"READS / WRITES", std::format("{:10} reads", stats_.reads),
                  std::format("{:10} writes", stats_.writes)});
   stats.separator();
-  dump.append(stats.to_string());
-  return dump;
+  stats.add_row({"TIME MARK / SWEEP", ns_to_us(stats_.mark_ns),
+                 ns_to_us(stats_.sweep_ns)});
+  stats.add_row({"TIME DECOMMIT", ns_to_us(stats_.decommit_ns), ""});
+  stats.separator();
+  auto add_pauses = [&stats](std::string name, const PauseHistogram &pauses) {
+    stats.add_row({name + " (p50 / p99)", ns_to_us(pauses.percentile(0.5)),
+                   ns_to_us(pauses.percentile(0.99))});
+    stats.add_row({name + " (max)", ns_to_us(pauses.max_ns),
+                   std::format("{:10} pauses", pauses.count)});
+  };
+  if (!incremental || stats_.full_pauses.count > 0) {
+    add_pauses("PAUSE FULL", stats_.full_pauses);
+  }
+  if (incremental) {
+    add_pauses("PAUSE INCR", stats_.incremental_pauses);
+  }
+  stats.separator();
+  auto mmu = mutator_utilization_.get();
+  stats.add_row({"MMU (1 ms / 10 ms)", std::format("{:14.1f} %", 100 * mmu[0]),
+                 std::format("{:14.1f} %", 100 * mmu[1])});
+  stats.add_row({"MMU (100 ms / 1 s)",
+                 std::format("{:14.1f} %", 100 * mmu[2]),
+                 std::format("{:14.1f} %", 100 * mmu[3])});
+  stats.separator();
 }
 
-std::string MarkAndSweep::dump_roots() const {
-  std::string dump;
-  dump.append("ROOTS\n");
-  tables::Table roots({3, 23, 23});
+void MarkAndSweep::dump_census(
+    std::ostream &out,
+    const std::function<std::string(size_t)> &kind_name) const {
+  out << "CENSUS\n";
+  tables::Table census({26, 16, 17}, out);
+  census.separator();
+  census.add_row({"TAKEN AFTER", "",
+                  std::format("{:10} cycles", last_census_.collection)});
+  census.separator();
+  auto add_entry = [&census](std::string_view name, CensusEntry entry) {
+    if (entry.objects > 0) {
+      census.add_row({name, std::format("{:10} bytes", entry.bytes),
+                      std::format("{:9} objects", entry.objects)});
+    }
+  };
+  for (size_t kind = 0; kind < last_census_.by_kind.size(); kind++) {
+    add_entry(kind_name(kind), last_census_.by_kind[kind]);
+  }
+  census.separator();
+  for (size_t words = 0; words < last_census_.by_size.size(); words++) {
+    auto bytes = words * sizeof(pointer_t);
+    add_entry(words < census_max_words
+                  ? std::format("SIZE {} bytes", bytes)
+                  : std::format("SIZE {}+ bytes", bytes),
+              last_census_.by_size[words]);
+  }
+  census.separator();
+}
+
+void MarkAndSweep::dump_census_history(
+    std::ostream &out,
+    const std::function<std::string(size_t)> &kind_name) const {
+  out << "collection,kind,objects,bytes\n";
+  for (auto &census : census_history_) {
+    for (size_t kind = 0; kind < census.by_kind.size(); kind++) {
+      auto entry = census.by_kind[kind];
+      if (entry.objects > 0) {
+        out << census.collection << ',' << kind_name(kind) << ','
+            << entry.objects << ',' << entry.bytes << '\n';
+      }
+    }
+  }
+}
+
+void MarkAndSweep::dump_roots(std::ostream &out) const {
+  out << "ROOTS\n";
+  tables::Table roots({3, 23, 23}, out);
   roots.separator();
   roots.add_row({"IDX", "ADDRESS", "VALUE"});
   roots.separator();
-  for (size_t i = 0; i < roots_.size(); i++) {
-    roots.add_row({std::format("{:3}", i + 1), pointer_to_hex(roots_.at(i)),
-                   pointer_to_hex(*roots_.at(i))});
-  }
+  size_t i = 0;
+  for_each_root([&](void **root) {
+    roots.add_row({text("{:3}", ++i), to_hex(root), to_hex(*root)});
+  });
   roots.separator();
-  dump.append(roots.to_string());
-  return dump;
 }
 
-std::string MarkAndSweep::dump_blocks() const {
-  std::string dump;
-  dump.append("BLOCKS\n");
-  tables::Table blocks({23, 23, 23});
+void MarkAndSweep::dump_blocks(std::ostream &out, DumpOptions options) const {
+  assert(options.sample_every > 0);
+  out << "BLOCKS\n";
+  tables::Table blocks({23, 23, 23}, out);
   blocks.separator();
-  blocks.add_row({"FREELIST", pointer_to_hex(freelist_), ""});
+  blocks.add_row({"FREELIST", to_hex(freelist_), ""});
   if (incremental) {
     blocks.separator();
     switch (phase_) {
@@ -520,59 +1386,380 @@ std::string MarkAndSweep::dump_blocks() const {
       blocks.add_row({"PHASE", "MARK", ""});
       blocks.add_row(
           {"NEXT",
-           pointer_to_hex(mark_queue_.empty() ? nullptr : mark_queue_.front()),
+           to_hex(mark_queue_.empty() ? nullptr : mark_queue_.front()),
            ""});
       break;
     case SWEEP:
       blocks.add_row({"PHASE", "SWEEP", ""});
-      blocks.add_row({"NEXT", pointer_to_hex(resume_sweep_from), ""});
+      blocks.add_row({"NEXT", to_hex(resume_sweep_from), ""});
       break;
     }
   }
   blocks.separator();
   blocks.add_row({"ADDRESS", "VALUE", "DESCRIPTION"});
   blocks.separator();
+  size_t block_n = 0;
+  size_t rows = 0;
+  size_t omitted_blocks = 0;
   auto p = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(space_start_) +
                                     sizeof(Metadata));
   while (p < space_end_) {
     auto block_idx = pointer_to_idx(p);
     auto block_meta = get_metadata(block_idx);
+    p = reinterpret_cast<void *>(&space_[block_idx + block_meta->block_size]);
+    if (block_n++ % options.sample_every != 0 ||
+        (options.max_rows && rows >= options.max_rows)) {
+      omitted_blocks++;
+      continue;
+    }
     for (size_t i = 0; i < block_meta->block_size; i += sizeof(pointer_t)) {
+      if (options.max_rows && rows >= options.max_rows) {
+        break;
+      }
+      rows++;
       auto v =
           reinterpret_cast<void *>(&space_[block_idx + i - sizeof(Metadata)]);
+      auto value = to_hex(*reinterpret_cast<void **>(v));
       if (i == 0) {
         auto status = block_meta->mark == FREE ? "FREE" : "USED";
         blocks.add_row(
-            {pointer_to_hex(v), pointer_to_hex(*reinterpret_cast<void **>(v)),
-             std::format("size: {:10}   {}", block_meta->block_size, status)});
+            {to_hex(v), value,
+             text("size: {:10}   {}", block_meta->block_size, status)});
       } else {
         if (block_meta->mark == FREE) {
           if (i == sizeof(pointer_t)) {
-            blocks.add_row({pointer_to_hex(v),
-                            pointer_to_hex(*reinterpret_cast<void **>(v)),
-                            "next free block"});
+            blocks.add_row({to_hex(v), value, "next free block"});
           } else {
-            blocks.add_row({pointer_to_hex(v),
-                            pointer_to_hex(*reinterpret_cast<void **>(v)), ""});
+            blocks.add_row({to_hex(v), value, ""});
           }
         } else {
-          blocks.add_row({pointer_to_hex(v),
-                          pointer_to_hex(*reinterpret_cast<void **>(v)),
-                          std::format("field #{}", i / sizeof(pointer_t))});
+          blocks.add_row({to_hex(v), value,
+                          text("field #{}", i / sizeof(pointer_t))});
         }
       }
     }
     blocks.separator();
-    p = reinterpret_cast<void *>(&space_[block_idx + block_meta->block_size]);
   }
-  dump.append(blocks.to_string());
-  return dump;
+  if (omitted_blocks > 0) {
+    blocks.add_row({"OMITTED", text("{:10} blocks", omitted_blocks), ""});
+    blocks.separator();
+  }
+}
+
+void MarkAndSweep::write_snapshot(std::ostream &out) const {
+  write_heap(out, nullptr, nullptr, {});
+}
+
+void MarkAndSweep::write_image(std::ostream &out,
+                               const std::vector<void *> &roots,
+                               const void *external_base,
+                               MemoryRange external) const {
+  if (!large_objects_.empty()) {
+    throw std::runtime_error("heap images can't contain large objects");
+  }
+  log("write image");
+  write_heap(out, &roots, external_base, external);
+}
+
+void MarkAndSweep::write_heap(std::ostream &out,
+                              const std::vector<void *> *image_roots,
+                              const void *external_base,
+                              MemoryRange external) const {
+  static_assert(sizeof(SnapshotMetadata) == sizeof(Metadata) &&
+                offsetof(SnapshotMetadata, header) ==
+                    offsetof(Metadata, header) &&
+                offsetof(SnapshotMetadata, block_size) ==
+                    offsetof(Metadata, block_size));
+  static_assert(SnapshotMetadata::NOT_MARKED == NOT_MARKED &&
+                SnapshotMetadata::MARKED == MARKED &&
+                SnapshotMetadata::FREE == FREE);
+  auto image = image_roots != nullptr;
+  // an image ends with the last used block
+  size_t space_size = max_memory;
+  if (image) {
+    space_size = 0;
+    for (size_t block_start = 0; block_start < max_memory;) {
+      auto meta = get_metadata(block_start + sizeof(Metadata));
+      block_start += meta->block_size;
+      if (meta->mark != FREE) {
+        space_size = block_start;
+      }
+    }
+  }
+  auto in_section = [this, space_size](void *block) {
+    return pointer_to_idx(block) < space_size;
+  };
+  size_t n_free_blocks = 0;
+  for (auto p = freelist_; p; p = *reinterpret_cast<void **>(p)) {
+    n_free_blocks += in_section(p);
+  }
+  auto align = [](uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+  };
+  SnapshotHeader header{};
+  std::copy(std::begin(SnapshotHeader::expected_magic),
+            std::end(SnapshotHeader::expected_magic), header.magic);
+  header.version = SnapshotHeader::current_version;
+  header.flags =
+      (merge_blocks ? SnapshotHeader::FLAG_MERGE_BLOCKS : 0) |
+      (skip_first_field ? SnapshotHeader::FLAG_SKIP_FIRST_FIELD : 0) |
+      (incremental ? SnapshotHeader::FLAG_INCREMENTAL : 0) |
+      (merged_header ? SnapshotHeader::FLAG_MERGED_HEADER : 0) |
+      (compressed_refs ? SnapshotHeader::FLAG_COMPRESSED_REFS : 0) |
+      (image ? SnapshotHeader::FLAG_IMAGE : 0);
+  header.space_start = reinterpret_cast<uintptr_t>(space_start_);
+  header.space_size = space_size;
+  header.metadata_size = sizeof(Metadata);
+  header.freelist = reinterpret_cast<uintptr_t>(freelist_);
+  header.n_roots = image ? image_roots->size() : n_roots();
+  header.roots_offset = sizeof(SnapshotHeader);
+  header.n_free_blocks = n_free_blocks;
+  header.freelist_offset =
+      header.roots_offset + header.n_roots * sizeof(SnapshotRoot);
+  header.space_offset =
+      align(header.freelist_offset + n_free_blocks * sizeof(uint64_t),
+            SnapshotHeader::space_alignment);
+  header.collections = stats_.collections;
+  header.incremental_collections = stats_.incremental_collections;
+  header.external_base = reinterpret_cast<uintptr_t>(external_base);
+  header.external_start = reinterpret_cast<uintptr_t>(external.begin);
+  header.external_end = reinterpret_cast<uintptr_t>(external.end);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // small sections go through a fixed-size buffer
+  std::array<uint64_t, 512> buffer;
+  size_t buffered = 0;
+  auto put = [&](uint64_t v) {
+    buffer[buffered++] = v;
+    if (buffered == buffer.size()) {
+      out.write(reinterpret_cast<const char *>(buffer.data()),
+                buffered * sizeof(uint64_t));
+      buffered = 0;
+    }
+  };
+  if (image) {
+    for (size_t i = 0; i < image_roots->size(); i++) {
+      put(i);
+      put(reinterpret_cast<uintptr_t>((*image_roots)[i]));
+    }
+  } else {
+    for_each_root([&](void **root) {
+      put(reinterpret_cast<uintptr_t>(root));
+      put(reinterpret_cast<uintptr_t>(*root));
+    });
+  }
+  for (auto p = freelist_; p; p = *reinterpret_cast<void **>(p)) {
+    if (in_section(p)) {
+      put(reinterpret_cast<uintptr_t>(p));
+    }
+  }
+  auto written = header.freelist_offset + n_free_blocks * sizeof(uint64_t);
+  for (; written < header.space_offset; written += sizeof(uint64_t)) {
+    put(0);
+  }
+  out.write(reinterpret_cast<const char *>(buffer.data()),
+            buffered * sizeof(uint64_t));
+  // heap is written as is
+  out.write(reinterpret_cast<const char *>(space_.get()), space_size);
+}
+
+std::vector<void *> MarkAndSweep::load_image(int fd,
+                                             const void *external_base) {
+  log("load image");
+  if (stats_.n_blocks_used > 0 || !large_objects_.empty()) {
+    throw std::runtime_error("heap is not empty");
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    throw std::system_error(errno, std::generic_category(), "fstat");
+  }
+  auto file_size = static_cast<size_t>(file_stat.st_size);
+  if (file_size < sizeof(SnapshotHeader)) {
+    throw std::runtime_error("image is too small");
+  }
+  // read-only view for validation and roots
+  auto view = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (view == MAP_FAILED) {
+    throw std::system_error(errno, std::generic_category(), "mmap");
+  }
+  std::unique_ptr<unsigned char[], Unmap> file(
+      static_cast<unsigned char *>(view), Unmap{file_size});
+  Snapshot image({file.get(), file_size});
+  auto &header = image.header();
+  const uint32_t layout_flags = SnapshotHeader::FLAG_SKIP_FIRST_FIELD |
+                                SnapshotHeader::FLAG_MERGED_HEADER |
+                                SnapshotHeader::FLAG_COMPRESSED_REFS;
+  auto layout =
+      (skip_first_field ? SnapshotHeader::FLAG_SKIP_FIRST_FIELD : 0) |
+      (merged_header ? SnapshotHeader::FLAG_MERGED_HEADER : 0) |
+      (compressed_refs ? SnapshotHeader::FLAG_COMPRESSED_REFS : 0);
+  if (!(header.flags & SnapshotHeader::FLAG_IMAGE)) {
+    throw std::runtime_error("not a heap image");
+  }
+  if ((header.flags & layout_flags) != layout) {
+    throw std::runtime_error("image has a different object layout");
+  }
+  auto size = header.space_size;
+  if (size > max_memory || size % sizeof(pointer_t) != 0 ||
+      (size < max_memory &&
+       max_memory - size < sizeof(Metadata) + sizeof(pointer_t))) {
+    throw std::runtime_error("image doesn't fit the heap");
+  }
+
+  auto old_start = static_cast<uintptr_t>(header.space_start);
+  if (reinterpret_cast<uintptr_t>(space_start_) != old_start &&
+      huge_pages_ == HugePages::NONE) {
+    // the heap is empty, it can be moved where the image was written
+    auto moved = mmap(reinterpret_cast<void *>(old_start), max_memory,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                          MAP_FIXED_NOREPLACE,
+                      -1, 0);
+    if (moved == reinterpret_cast<void *>(old_start)) {
+      space_.reset(static_cast<unsigned char *>(moved));
+      space_start_ = space_.get();
+      space_end_ = &space_[max_memory];
+    } else if (moved != MAP_FAILED) {
+      // taken as a hint by older kernels
+      munmap(moved, max_memory);
+    }
+  }
+  // huge pages can't be partly replaced by the file's pages
+  auto file_page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto mapped =
+      huge_pages_ == HugePages::NONE && size > 0 &&
+      header.space_offset % file_page_size == 0 &&
+      mmap(space_.get(), size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+           fd, static_cast<off_t>(header.space_offset)) != MAP_FAILED;
+  if (!mapped) {
+    std::copy_n(&file[header.space_offset], size, space_.get());
+  }
+
+  auto clear = [this] {
+    stats_.n_blocks_used = 0;
+    stats_.n_blocks_free = 0;
+    stats_.n_blocks_total = 0;
+    stats_.bytes_used = 0;
+    stats_.bytes_free = 0;
+    if (block_starts_) {
+      // zero-filled again
+      madvise(block_starts_.get(), block_starts_.get_deleter().size,
+              MADV_DONTNEED);
+    }
+  };
+  clear();
+  auto fail = [&](const char *what) {
+    clear();
+    *create_free_blocks(0, &freelist_) = nullptr;
+    throw std::runtime_error(what);
+  };
+  // Pointers into the image move with the heap, all others with
+  // `external_base`. Fields are only rewritten if one of them moved, so that
+  // the pages of the image stay shared with the file.
+  auto delta = reinterpret_cast<uintptr_t>(space_start_) - old_start;
+  auto external_delta =
+      external_base && header.external_base
+          ? reinterpret_cast<uintptr_t>(external_base) - header.external_base
+          : 0;
+  auto relocate = [&](void *value) {
+    auto v = reinterpret_cast<uintptr_t>(value);
+    if (v == 0) {
+      return value;
+    }
+    if (old_start <= v && v < old_start + size) {
+      return reinterpret_cast<void *>(v + delta);
+    }
+    if (v < header.external_start || v >= header.external_end) {
+      fail("corrupted pointer");
+    }
+    return reinterpret_cast<void *>(v + external_delta);
+  };
+  auto relocate_fields =
+      !compressed_refs && (delta != 0 || external_delta != 0);
+  void **last_link = &freelist_;
+  for (size_t block_start = 0; block_start < size;) {
+    auto meta = reinterpret_cast<Metadata *>(&space_[block_start]);
+    if (meta->block_size <= sizeof(Metadata) ||
+        meta->block_size % sizeof(pointer_t) != 0 ||
+        meta->block_size > size - block_start ||
+        static_cast<mark_t>(meta->mark) > FREE) {
+      fail("corrupted block metadata");
+    }
+    auto block = &space_[block_start + sizeof(Metadata)];
+    if (meta->mark == FREE) {
+      meta->done = 0;
+      *last_link = block;
+      last_link = reinterpret_cast<void **>(block);
+      stats_.n_blocks_free++;
+      stats_.bytes_free += meta->block_size;
+    } else {
+      // unchanged metadata is not written
+      if (meta->mark != NOT_MARKED) {
+        meta->mark = NOT_MARKED;
+      }
+      if (relocate_fields) {
+        auto field_n = field_count(meta);
+        for (size_t i = skip_first_field ? 1 : 0; i < field_n; i++) {
+          store_field(block, i, relocate(load_field(block, i)));
+        }
+      }
+      stats_.n_blocks_used++;
+      stats_.bytes_used += meta->block_size;
+    }
+    if (block_starts_) {
+      set_block_start(block, true);
+    }
+    stats_.n_blocks_total++;
+    block_start += meta->block_size;
+  }
+  *create_free_blocks(size, last_link) = nullptr;
+  std::vector<void *> roots;
+  roots.reserve(image.roots().size());
+  for (auto &root : image.roots()) {
+    roots.push_back(relocate(reinterpret_cast<void *>(root.value)));
+  }
+  stats_.n_blocks_used_max =
+      std::max(stats_.n_blocks_used_max, stats_.n_blocks_used);
+  stats_.bytes_used_max = std::max(stats_.bytes_used_max, stats_.bytes_used);
+  if (incremental) {
+    // a cycle starts from the roots the image's roots are pushed as
+    phase_ = MARK;
+    phase_change_pending_ = false;
+    mark_queue_ = {};
+  }
+  return roots;
 }
 
 // incremental collection
 
+template <typename F> void MarkAndSweep::incr_step(F step) {
+  auto start = clock::now();
+  auto decommit_ns = stats_.decommit_ns;
+  auto phase = phase_;
+  step();
+  auto end = clock::now();
+  auto step_ns = elapsed_ns(start, end);
+  if (phase == MARK) {
+    stats_.mark_ns += step_ns;
+  } else {
+    // decommit at the end of the cycle is timed separately
+    decommit_ns = stats_.decommit_ns - decommit_ns;
+    stats_.sweep_ns += step_ns - std::min(step_ns, decommit_ns);
+  }
+  stats_.incremental_pauses.record(step_ns);
+  mutator_utilization_.record(start, end);
+}
+
 void MarkAndSweep::incr_collect(size_t bytes) {
   log("incremental collect");
+  if (phase_change_pending_) {
+    // nothing to do until change_phase()
+    return;
+  }
+  incr_step([this, bytes] { incr_work(bytes); });
+}
+
+void MarkAndSweep::incr_work(size_t bytes) {
   switch (phase_) {
   case MARK:
     incr_mark(bytes);
@@ -583,36 +1770,154 @@ void MarkAndSweep::incr_collect(size_t bytes) {
   }
 }
 
+void MarkAndSweep::defer_phase_changes(bool defer) {
+  defer_phase_changes_ = defer;
+}
+
+bool MarkAndSweep::phase_change_pending() const {
+  return phase_change_pending_;
+}
+
+void MarkAndSweep::change_phase() {
+  assert(phase_change_pending_ && "no phase change is pending");
+  log("change phase");
+  phase_change_pending_ = false;
+  incr_step([this] { next_phase(); });
+}
+
+void MarkAndSweep::next_phase() {
+  switch (phase_) {
+  case MARK:
+    // roots can't change meanwhile, marking is finished at once
+    rescan_roots();
+    while (!mark_queue_.empty()) {
+      mark_next();
+    }
+    start_sweep();
+    break;
+  case SWEEP:
+    finish_sweep();
+    break;
+  }
+}
+
+void MarkAndSweep::finish_cycle() {
+  assert(incremental && "only incremental cycles can be finished");
+  log("finish cycle");
+  stats_.incremental_fallbacks++;
+  auto start = clock::now();
+  complete_cycle();
+  auto end = clock::now();
+  // the world is stopped for the whole cycle, just like in a collection
+  stats_.full_pauses.record(elapsed_ns(start, end));
+  mutator_utilization_.record(start, end);
+}
+
+void MarkAndSweep::complete_cycle() {
+  phase_change_pending_ = false;
+  auto start = clock::now();
+  auto decommit_ns = stats_.decommit_ns;
+  if (phase_ == MARK) {
+    next_phase();
+  }
+  auto marked = clock::now();
+  if (resume_sweep_from < space_end_) {
+    incr_sweep(std::numeric_limits<size_t>::max());
+  }
+  if (phase_ == SWEEP) {
+    // the end of the heap was reached with phase changes deferred
+    phase_change_pending_ = false;
+    next_phase();
+  }
+  auto sweep_ns = elapsed_ns(marked, clock::now());
+  decommit_ns = stats_.decommit_ns - decommit_ns;
+  stats_.mark_ns += elapsed_ns(start, marked);
+  stats_.sweep_ns += sweep_ns - std::min(sweep_ns, decommit_ns);
+}
+
+bool MarkAndSweep::step(size_t bytes, clock::time_point deadline) {
+  assert(incremental && "only incremental cycles can be stepped");
+  log("step");
+  auto cycles = stats_.incremental_collections;
+  // timed as one step of the phase it starts in
+  incr_step([&] {
+    size_t done = 0;
+    while (stats_.incremental_collections == cycles &&
+           (bytes == 0 || done < bytes)) {
+      if (phase_change_pending_) {
+        phase_change_pending_ = false;
+        next_phase();
+        continue;
+      }
+      auto chunk = bytes == 0 ? step_chunk : std::min(step_chunk, bytes - done);
+      incr_work(chunk);
+      done += chunk;
+      if (clock::now() >= deadline) {
+        break;
+      }
+    }
+  });
+  return stats_.incremental_collections != cycles;
+}
+
 void MarkAndSweep::incr_mark(size_t bytes) {
   log("incremental mark");
   size_t bytes_marked = 0;
   while (bytes_marked < bytes) {
     if (mark_queue_.empty()) {
-      stats_.collected_objects.clear();
-      phase_ = SWEEP;
-      resume_sweep_from = reinterpret_cast<void *>(
-          reinterpret_cast<uintptr_t>(space_start_) + sizeof(Metadata));
+      if (defer_phase_changes_) {
+        phase_change_pending_ = true;
+        return;
+      }
+      // roots are updated without barriers, rescan them before sweeping
+      rescan_roots();
+      if (!mark_queue_.empty()) {
+        continue;
+      }
+      start_sweep();
       return;
     }
-    auto next = mark_queue_.front();
-    mark_queue_.pop();
-    auto next_idx = pointer_to_idx(next);
-    auto next_meta = get_metadata(next_idx);
-    if (next_meta->mark == NOT_MARKED) {
-      bytes_marked += next_meta->block_size;
-      next_meta->mark = MARKED;
-      auto obj_size = next_meta->block_size - sizeof(Metadata);
-      assert(obj_size % sizeof(pointer_t) == 0);
-      auto field_n = obj_size / sizeof(pointer_t);
-      for (size_t i = 0; i < field_n; i++) {
-        auto field_i = *reinterpret_cast<void **>(
-            &space_[next_idx + i * sizeof(pointer_t)]);
-        if (is_in_space(field_i)) {
-          mark_queue_.push(field_i);
-        }
-      }
+    bytes_marked += mark_next();
+  }
+}
+
+size_t MarkAndSweep::mark_next() {
+  auto next = mark_queue_.front();
+  mark_queue_.pop();
+  auto next_meta = object_metadata(next);
+  if (next_meta->mark != NOT_MARKED) {
+    return 0;
+  }
+  next_meta->mark = MARKED;
+  auto field_n = field_count(next_meta);
+  for (size_t i = skip_first_field ? 1 : 0; i < field_n; i++) {
+    auto field_i = from_object(load_field(next, i));
+    if (is_heap_object(field_i)) {
+      mark_queue_.push(field_i);
     }
   }
+  return next_meta->block_size;
+}
+
+void MarkAndSweep::rescan_roots() {
+  for_each_root([this](void **root) {
+    auto obj = from_object(*root);
+    if (is_heap_object(obj) && object_metadata(obj)->mark == NOT_MARKED) {
+      mark_queue_.push(obj);
+    }
+  });
+}
+
+void MarkAndSweep::start_sweep() {
+  if (sweep_observer_) {
+    sweep_observer_->sweep_started();
+  }
+  start_census();
+  // only the heap is swept incrementally
+  sweep_large_objects();
+  phase_ = SWEEP;
+  resume_sweep_from = reinterpret_cast<void *>(
+      reinterpret_cast<uintptr_t>(space_start_) + sizeof(Metadata));
 }
 
 void MarkAndSweep::incr_sweep(size_t bytes) {
@@ -625,13 +1930,19 @@ void MarkAndSweep::incr_sweep(size_t bytes) {
     bytes_marked += block_meta->block_size;
     if (block_meta->mark == MARKED) {
       block_meta->mark = NOT_MARKED;
+      if (census_enabled_) {
+        count_live(p, block_meta->block_size);
+      }
     } else if (block_meta->mark == NOT_MARKED) {
+      if (sweep_observer_) {
+        sweep_observer_->collected(to_object(p));
+      }
       block_meta->mark = FREE;
+      block_meta->done = 0;
       *reinterpret_cast<void **>(p) = freelist_;
       freelist_ = p;
       assert(stats_.n_blocks_used > 0);
       assert(stats_.bytes_used >= block_meta->block_size);
-      stats_.collected_objects.push_back(p);
       stats_.n_blocks_used--;
       stats_.n_blocks_free++;
       stats_.bytes_used -= block_meta->block_size;
@@ -639,18 +1950,34 @@ void MarkAndSweep::incr_sweep(size_t bytes) {
     }
     p = reinterpret_cast<void *>(&space_[block_idx + block_meta->block_size]);
     if (p >= space_end_) {
-      MarkAndSweep::merge(); // TODO: incremental merge
-      phase_ = MARK;
-      for (auto root : roots_) {
-        if (is_in_space(*root)) {
-          mark_queue_.push(*root);
-        }
+      if (defer_phase_changes_) {
+        // everything is swept, new objects must not be marked
+        resume_sweep_from = p;
+        phase_change_pending_ = true;
+        return;
       }
-      stats_.incremental_collections++;
+      finish_sweep();
       return;
     }
     resume_sweep_from = p;
   }
 }
 
+void MarkAndSweep::finish_sweep() {
+  // timed as part of the sweep step
+  MarkAndSweep::merge(); // TODO: incremental merge
+  auto merged = clock::now();
+  decommit();
+  stats_.decommit_ns += elapsed_ns(merged, clock::now());
+  phase_ = MARK;
+  for_each_root([this](void **root) {
+    auto obj = from_object(*root);
+    if (is_heap_object(obj)) {
+      mark_queue_.push(obj);
+    }
+  });
+  stats_.incremental_collections++;
+  finish_census();
+}
+
 } // namespace gc
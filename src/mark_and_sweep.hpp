@@ -3,14 +3,24 @@
 #include <assert.h>
 #include <stddef.h>
 
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <ostream>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <queue>
 
+#include "pauses.hpp"
+
 namespace gc {
 
+// Counters only, so that polling them is cheap (see SweepObserver for the
+// objects freed by a sweep).
 struct Stats {
   size_t n_blocks_used;
   size_t n_blocks_free;
@@ -20,13 +30,89 @@ struct Stats {
   size_t bytes_used;
   size_t bytes_free;
   size_t bytes_used_max;
+  // free pages currently returned to the OS (see set_decommit), those taken
+  // by allocations or merged into other blocks are not counted anymore
+  size_t bytes_decommitted;
+  // the large object space (see set_large_object_threshold), not included
+  // in the block counts above
+  size_t n_large_objects;
+  size_t bytes_large_objects;
 
   size_t reads;
   size_t writes;
 
   size_t collections;
   size_t incremental_collections;
-  std::vector<void *> collected_objects;
+  // incremental cycles finished at once because an allocation failed (see
+  // finish_cycle)
+  size_t incremental_fallbacks;
+
+  // time spent in each phase (full and incremental), merging free blocks
+  // counts as sweeping
+  uint64_t mark_ns;
+  uint64_t sweep_ns;
+  uint64_t decommit_ns;
+
+  PauseHistogram full_pauses;
+  PauseHistogram incremental_pauses;
+  // minimum mutator utilization for each of mmu_windows_ns
+  std::array<double, mmu_windows_ns.size()> mmu;
+};
+
+static_assert(std::is_trivially_copyable_v<Stats>);
+
+// Live objects of one kind or size counted by a census (see set_census).
+struct CensusEntry {
+  size_t objects = 0;
+  // with metadata
+  size_t bytes = 0;
+};
+
+// Objects that survived a sweep, by kind and by block size.
+struct Census {
+  // full collections and incremental cycles finished, this one included
+  // (0 = no census yet)
+  size_t collection = 0;
+  std::vector<CensusEntry> by_kind;
+  // by block size in words (metadata included), the last entry also counts
+  // all larger blocks and large objects
+  std::vector<CensusEntry> by_size;
+};
+
+// Notified of every object freed by a sweep (full or incremental), e.g. for
+// debugging or heap profiling.
+class SweepObserver {
+public:
+  virtual ~SweepObserver() = default;
+  // a full collection or an incremental cycle starts sweeping
+  virtual void sweep_started() {}
+  // `obj` (the mutator's pointer) is freed right after the call, its fields
+  // can still be read
+  virtual void collected(void *obj) = 0;
+};
+
+struct DumpOptions {
+  // print at most this many heap words in dump_blocks (0 = no limit)
+  size_t max_rows = 0;
+  // print only every n-th block in dump_blocks
+  size_t sample_every = 1;
+};
+
+// Pages backing the heap: regular ones, transparent huge pages (the kernel
+// is asked to back the range with huge pages, see MADV_HUGEPAGE) or explicit
+// huge pages taken from the hugetlbfs pool (MAP_HUGETLB).
+enum class HugePages {
+  NONE,
+  TRANSPARENT,
+  EXPLICIT,
+};
+
+// How full collections traverse the heap: Deutsch-Schorr-Waite pointer
+// reversal (no extra memory, but every field on the path is written twice)
+// or an explicit stack of objects whose fields are not scanned yet.
+enum class MarkStrategy {
+  POINTER_REVERSAL,
+  MARK_STACK,
 };
 
 class MarkAndSweep {
@@ -35,32 +121,227 @@ public:
   const bool merge_blocks;
   const bool skip_first_field;
   const bool incremental;
+  // Objects share their first word with the block metadata: object pointers
+  // point at the metadata instead of past it and the object's size includes
+  // that word, of which only the lowest byte belongs to the mutator (Stella
+  // keeps its tag and field count there). Saves a word per object.
+  const bool merged_header;
+  // Fields are 32-bit references (see compress) instead of pointers, which
+  // halves pointer-heavy objects. Requires `merged_header` and a heap of at
+  // most max_compressed_memory bytes, large objects are not supported.
+  const bool compressed_refs;
 
   using block_size_t = uint32_t;
   using done_t = uint16_t;
-  using mark_t = uint16_t;
+  using mark_t = uint8_t;
   using pointer_t = void *;
+  using ref_t = uint32_t;
+  using RootStack = std::vector<void **>;
+
+  // Thread-local allocation buffer (see SharedHeap): a block taken from the
+  // freelist and split into objects by bumping `top`, without touching the
+  // collector. While a buffer is in use the heap can't be walked (collected,
+  // dumped), retire_tlab makes it walkable again.
+  struct Tlab {
+    unsigned char *start = nullptr;
+    unsigned char *top = nullptr;
+    unsigned char *end = nullptr;
+    size_t n_objects = 0;
+    bool merged_header = false;
+    bool compressed_refs = false;
+    // see enable_conservative_roots (nullptr = disabled)
+    unsigned char *block_starts = nullptr;
+    const unsigned char *space_start = nullptr;
+  };
+
+  // memory scanned for conservative roots, e.g. a thread's stack
+  struct MemoryRange {
+    const void *begin;
+    const void *end;
+  };
 
+  static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+  // references with this bit set belong to the mutator (e.g. indices of
+  // pointers outside of the heap) and are never traced
+  static constexpr ref_t external_ref_bit = ref_t(1) << 31;
+  // every word of the heap must be addressable by a reference
+  static constexpr size_t max_compressed_memory =
+      (external_ref_bit - 1) * sizeof(pointer_t);
+
+  // With huge pages the heap is aligned to huge_page_size. If they are
+  // unavailable, explicit huge pages fall back to transparent ones and those
+  // to regular pages (see huge_pages()).
+  // `skip_first_field` is not supported with `merged_header` (the shared word
+  // is never scanned).
   MarkAndSweep(size_t max_memory, bool merge_blocks, bool skip_first_field,
-               bool incremental);
+               bool incremental, HugePages huge_pages = HugePages::NONE,
+               bool merged_header = false, bool compressed_refs = false);
+
+  ~MarkAndSweep();
 
   Stats get_stats() const;
+  // memory used by blocks and large objects (get_stats().bytes_used +
+  // bytes_large_objects), without copying the stats
+  size_t bytes_used() const;
+  // get_stats().bytes_free, without copying the stats
+  size_t bytes_free() const;
+  // pages actually backing the heap
+  HugePages huge_pages() const;
   const std::vector<void **> &get_roots() const;
 
+  // Compressed references: 0 is nullptr, an object in the heap is its offset
+  // from the start of the heap in words plus one. Only depend on the heap's
+  // address range, so they can be used without stopping the world.
+  // `obj` must be nullptr or an object in the heap.
+  ref_t compress(void *obj) const;
+  // nullptr for external references
+  void *decompress(ref_t ref) const;
+  // whether `obj` (the mutator's pointer) is an object in the heap (not a
+  // large object)
+  bool contains(void const *obj) const;
+
   void push_root(void **root);
   void pop_root(void **root);
 
+  // Root stacks besides the collector's own (e.g. one per thread), scanned
+  // together with it. A stack must stay alive while it is registered.
+  void add_root_stack(RootStack *stack);
+  void remove_root_stack(RootStack *stack);
+  void push_root(RootStack &stack, void **root);
+  void pop_root(RootStack &stack, void **root);
+
+  // Conservative roots: words of scanned memory that are exactly the pointer
+  // of an allocated object (not into one) keep it alive like roots do.
+  // Objects never move, so they are pinned for free. Candidates are checked
+  // against a map of block starts (a bit per heap word), which is kept from
+  // here on, so this must be called while no buffer is in use.
+  void enable_conservative_roots();
+  bool conservative_roots() const { return block_starts_ != nullptr; }
+  // Replaces the conservative roots with the objects referenced from the
+  // words of `ranges`, they stay roots until cleared.
+  void scan_conservative_roots(const std::vector<MemoryRange> &ranges);
+  void clear_conservative_roots();
+
   void *allocate(std::size_t bytes);
+  // in incremental mode finishes the cycle in progress and runs a whole new
+  // one (same requirements as change_phase())
   void collect();
 
+  // After every collection, return the pages inside free blocks of at least
+  // `min_block_size` bytes to the OS (0 = never). They are committed again
+  // (zeroed) when touched. With `lazy` the kernel may keep them until there
+  // is memory pressure (MADV_FREE instead of MADV_DONTNEED).
+  void set_decommit(size_t min_block_size, bool lazy = false);
+
+  // Objects of at least `bytes` bytes (0 = none) are not allocated in the
+  // heap, but get their own page-granular mapping: they are marked in place
+  // and unmapped when collected, so they never fragment the heap. Blocks and
+  // large objects together are bounded by max_memory. Not supported with
+  // `compressed_refs`.
+  void set_large_object_threshold(size_t bytes);
+
+  // nullptr = none (the default, then sweeping pays nothing for it), the
+  // observer must stay alive while it is set
+  void set_sweep_observer(SweepObserver *observer);
+
+  // Every sweep counts the objects it keeps per kind and per size. The kind
+  // of an object is the lowest byte of its first word (the mutator's, Stella
+  // keeps its tag there) masked with `kind_mask`. Disabled by default, then
+  // sweeping pays nothing for it. Every `history_every`-th census (0 = none)
+  // is also kept in census_history.
+  void set_census(bool enabled, uint8_t kind_mask = 0xff,
+                  size_t history_every = 0);
+  // the census of the last finished sweep
+  const Census &census() const { return last_census_; }
+  const std::vector<Census> &census_history() const {
+    return census_history_;
+  }
+  static constexpr size_t census_max_words = 32;
+
+  // Traversal used by full collections (incremental steps always use a
+  // queue). The mark stack holds at most `max_stack` objects, objects found
+  // while it is full are marked by pointer reversal instead.
+  void set_mark_strategy(MarkStrategy strategy,
+                         size_t max_stack = default_max_mark_stack);
+  static constexpr size_t default_max_mark_stack = 64 * 1024;
+
+  // take a free block of at least `bytes` bytes (metadata included) as a new
+  // buffer, not supported in incremental mode
+  bool refill_tlab(Tlab &tlab, std::size_t bytes);
+  // nullptr if the object doesn't fit in the buffer
+  static void *allocate_in_tlab(Tlab &tlab, std::size_t bytes);
+  // the space an object of `bytes` bytes takes in the heap (or a buffer)
+  static size_t block_size_for(std::size_t bytes, bool merged_header);
+  // objects stay allocated, the unused tail is returned to the freelist
+  void retire_tlab(Tlab &tlab);
+
+  // Incremental mode: a step moves to the next phase by itself, unless phase
+  // changes are deferred (see SharedHeap). Then steps stop at the end of a
+  // phase and change_phase() must be called while no mutator holds an
+  // unrooted object (e.g. with all threads stopped at allocation).
+  void defer_phase_changes(bool defer);
+  bool phase_change_pending() const;
+  void change_phase();
+  // Incremental mode: finishes the cycle in progress at once (the rest of
+  // marking and sweeping), when allocation fails before it would free
+  // memory. Called again right away, runs a whole new cycle. Same
+  // requirements as change_phase().
+  void finish_cycle();
+  // Incremental mode: does about `bytes` bytes of marking and sweeping (0 =
+  // no limit) until `deadline`, moving to the next phase as needed, but
+  // stops at the end of the cycle. Returns true if the cycle finished. Same
+  // requirements as change_phase().
+  bool step(std::size_t bytes, clock::time_point deadline);
+
   void read(void *obj);
   void write(void *to, void *contents);
+  // add reads / writes counted elsewhere (e.g. by other threads)
+  void count_accesses(size_t reads, size_t writes);
 
   std::string dump() const;
   std::string dump_stats() const;
   std::string dump_roots() const;
   std::string dump_blocks() const;
 
+  // same as above, but written to `out` row by row
+  void dump(std::ostream &out, DumpOptions options = {}) const;
+  void dump_stats(std::ostream &out) const;
+  void dump_roots(std::ostream &out) const;
+  void dump_blocks(std::ostream &out, DumpOptions options = {}) const;
+  // the last census as a table, the history as CSV (collection, kind,
+  // objects, bytes), kinds without objects are left out
+  void dump_census(std::ostream &out,
+                   const std::function<std::string(size_t)> &kind_name) const;
+  void dump_census_history(
+      std::ostream &out,
+      const std::function<std::string(size_t)> &kind_name) const;
+
+  // binary heap snapshot, see snapshot.hpp for the format. Nothing but
+  // `out` is called, so it can be written in a forked child.
+  void write_snapshot(std::ostream &out) const;
+  // Heap image (a snapshot with FLAG_IMAGE): the heap with `roots` (the
+  // mutator's pointers) as its only roots, so that another process can load
+  // it instead of building the same objects again. Everything allocated is
+  // kept, so it should be written right after a collection. Other pointers
+  // (static objects, functions) must point into `external` (e.g. the
+  // program's text and data), they are relocated relative to
+  // `external_base` when loaded. Large objects are not supported (throws
+  // std::runtime_error).
+  void write_image(std::ostream &out, const std::vector<void *> &roots,
+                   const void *external_base = nullptr,
+                   MemoryRange external = {}) const;
+  // Replaces the contents of an empty heap (nothing allocated, no buffer in
+  // use) with the image in file `fd` and returns its roots. The heap is
+  // moved to the image's address if that range is free and the file is
+  // mapped copy-on-write, so pages are read when touched and pointers are
+  // only rewritten if the heap or `external_base` moved. The image must have
+  // the same object layout (skip_first_field, merged_header,
+  // compressed_refs) and fit the heap. Throws std::runtime_error for an
+  // invalid image (also for rewritten fields and roots that point neither
+  // into the image nor into its external range), std::system_error if the
+  // file can't be mapped; the heap stays empty then.
+  std::vector<void *> load_image(int fd, const void *external_base = nullptr);
+
 private:
   enum Mark : mark_t {
     NOT_MARKED,
@@ -68,10 +349,25 @@ private:
     FREE,
   };
 
+  // little-endian, the lowest byte comes first (see merged_header)
   struct Metadata {
-    block_size_t block_size;
-    done_t done;
+    // the mutator's with merged headers, unused otherwise
+    uint8_t header;
     Mark mark;
+    done_t done;
+    block_size_t block_size;
+  };
+
+  // `done` of a free block whose pages were returned to the OS
+  static const done_t DECOMMITTED = 1;
+
+  // larger heaps are split into several blocks, merged blocks stay below it
+  static constexpr size_t max_block_size =
+      std::numeric_limits<block_size_t>::max() & ~(sizeof(pointer_t) - 1);
+
+  struct Unmap {
+    size_t size;
+    void operator()(unsigned char *space) const;
   };
 
   static_assert(sizeof(Metadata) == sizeof(pointer_t));
@@ -80,24 +376,114 @@ private:
   const void *space_end_;
 
   Stats stats_;
-  std::unique_ptr<unsigned char[]> space_;
-  std::vector<void **> roots_;
+  // mmap'ed, see Unmap
+  std::unique_ptr<unsigned char[], Unmap> space_;
+  HugePages huge_pages_;
+  // granularity of decommit, huge pages are never split
+  size_t page_size_;
+  RootStack roots_;
+  std::vector<RootStack *> root_stacks_;
   void *freelist_;
+  MutatorUtilization mutator_utilization_;
+  size_t decommit_min_block_size_ = 0;
+  bool decommit_lazy_ = false;
+  size_t large_object_threshold_ = 0;
+  // objects of the large object space (metadata at the start of a mapping)
+  std::unordered_set<void *> large_objects_;
+  // large objects marked by a full collection, fields not scanned yet
+  std::vector<void *> large_mark_stack_;
+  MarkStrategy mark_strategy_ = MarkStrategy::MARK_STACK;
+  size_t max_mark_stack_ = default_max_mark_stack;
+  // marked objects, fields not scanned yet (see MarkStrategy)
+  std::vector<void *> mark_stack_;
+  SweepObserver *sweep_observer_ = nullptr;
+  // a bit per heap word, set where a block starts (internal pointers), see
+  // enable_conservative_roots
+  std::unique_ptr<unsigned char[], Unmap> block_starts_;
+  // objects found by scan_conservative_roots (mutator's pointers), sorted
+  std::vector<void *> conservative_roots_;
+  bool census_enabled_ = false;
+  uint8_t census_kind_mask_ = 0xff;
+  size_t census_history_every_ = 0;
+  // taken by the sweep in progress
+  Census census_;
+  Census last_census_;
+  std::vector<Census> census_history_;
+
+  // as few free blocks as possible from offset `start` to the end of the
+  // heap, linked after `last_link`, returns the last link
+  void **create_free_blocks(size_t start, void **last_link);
+  // a snapshot, or an image of `image_roots` (see write_image)
+  void write_heap(std::ostream &out, const std::vector<void *> *image_roots,
+                  const void *external_base, MemoryRange external) const;
+
+  void *allocate_block(std::size_t block_size);
+  void *allocate_large(std::size_t block_size);
 
   void dfs(void *x);
   void mark();
+  // marks an unmarked object in the heap and everything reachable from it,
+  // large objects are only pushed on large_mark_stack_
+  void mark_from(void *x);
+  void mark_large(void *x);
   void sweep();
+  void sweep_large_objects();
+  void start_census();
+  // `x` is an internal pointer
+  void count_live(void *x, size_t block_size);
+  void finish_census();
   void merge();
+  // Rebuilds the freelist one free block at a time (used by sweep and
+  // merge): the free block `x` (internal pointer) is merged into `merging`,
+  // the free block right before it, if there is one and the result isn't too
+  // large. Otherwise `x` is added to the freelist and becomes `merging`.
+  // Returns true if the blocks were merged.
+  bool coalesce(void *x, Metadata *meta, Metadata *&merging);
+  void decommit();
+  // pages of a free block that decommit() returns to the OS
+  std::pair<uintptr_t, uintptr_t> decommit_range(const Metadata *meta) const;
+  // resets `done` of a free block, its pages are committed again when touched
+  void recommit(Metadata *meta);
+
+  template <typename F> void for_each_root(F f) const;
+  size_t n_roots() const;
+  // Internally an object always starts right after its metadata, with merged
+  // headers the mutator's pointers are one word lower.
+  void *to_object(void *internal) const;
+  void *from_object(void *obj) const;
+  // fields of an object (internal pointer) as the mutator's pointers,
+  // decompressed with `compressed_refs`
+  size_t field_count(Metadata const *meta) const;
+  void *load_field(void *x, size_t i) const;
+  void store_field(void *x, size_t i, void *value) const;
 
   bool is_in_space(void const *obj) const;
+  bool is_large_object(void const *obj) const;
+  // a block in the heap or a large object
+  bool is_heap_object(void const *obj) const;
   bool is_valid_free_block(void const *obj) const;
+  // whether `word` is the mutator's pointer of an allocated object
+  bool is_object_pointer(void const *word) const;
+
+  // blocks are internal pointers, `block_starts` may be shared with buffers
+  static void set_block_start(unsigned char *block_starts,
+                              const unsigned char *space_start,
+                              const void *block, bool start);
+  void set_block_start(const void *block, bool start);
+  bool is_block_start(const void *block) const;
 
   size_t pointer_to_idx(void const *obj) const;
   Metadata *get_metadata(size_t obj_idx) const;
+  // metadata of a block or a large object
+  Metadata *object_metadata(void const *obj) const;
 
   // only used in incremental mode
   // vvvvvvvvvvvvvvvvvvvvvvvvvvvvv
   const size_t bytes_to_free_per_alloc_ = 4;
+  // small enough for the cycle to keep up in tiny heaps
+  const size_t incr_min_step_ = std::min<size_t>(4096, max_memory / 64);
+  // work owed by allocations since the last step
+  size_t incr_debt_ = 0;
   enum Phase {
     MARK,
     SWEEP,
@@ -105,10 +491,26 @@ private:
   Phase phase_ = Phase::MARK;
   std::queue<void *> mark_queue_;
   void *resume_sweep_from;
+  bool defer_phase_changes_ = false;
+  bool phase_change_pending_ = false;
+
+  // work done by step() between checks of its deadline
+  static constexpr std::size_t step_chunk = 64 * 1024;
 
+  template <typename F> void incr_step(F step);
   void incr_collect(std::size_t bytes);
+  // untimed bodies of incr_collect and change_phase
+  void incr_work(std::size_t bytes);
+  void next_phase();
+  // the rest of the cycle at once, the caller records the pause
+  void complete_cycle();
   void incr_mark(std::size_t bytes);
+  // returns the size of the block if it was marked, 0 otherwise
+  size_t mark_next();
+  void rescan_roots();
+  void start_sweep();
   void incr_sweep(std::size_t bytes);
+  void finish_sweep();
   //
 };
 
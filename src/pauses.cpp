@@ -0,0 +1,140 @@
+#include "pauses.hpp"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <bit>
+
+namespace gc {
+
+static size_t bucket_of(uint64_t ns) {
+  if (ns < 4) {
+    return ns;
+  }
+  size_t e = std::bit_width(ns) - 1;
+  return 4 * (e - 1) + ((ns >> (e - 2)) & 3);
+}
+
+static uint64_t bucket_upper_bound(size_t idx) {
+  if (idx < 4) {
+    return idx;
+  }
+  size_t e = idx / 4 + 1;
+  uint64_t sub = idx % 4;
+  return ((4 + sub + 1) << (e - 2)) - 1;
+}
+
+uint64_t elapsed_ns(clock::time_point from, clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from)
+      .count();
+}
+
+void PauseHistogram::record(uint64_t ns) {
+  auto idx = bucket_of(ns);
+  assert(idx < n_buckets);
+  buckets[idx]++;
+  count++;
+  total_ns += ns;
+  max_ns = std::max(max_ns, ns);
+}
+
+uint64_t PauseHistogram::percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(p * count);
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  size_t seen = 0;
+  for (size_t i = 0; i < n_buckets; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return std::min(bucket_upper_bound(i), max_ns);
+    }
+  }
+  return max_ns;
+}
+
+MutatorUtilization::MutatorUtilization() : origin_(clock::now()) {
+  min_.fill(1.0);
+  pending_.fill(0);
+}
+
+void MutatorUtilization::record(clock::time_point start,
+                                clock::time_point end) {
+  auto to_ns = [this](clock::time_point t) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin_)
+            .count());
+  };
+  auto s = to_ns(start);
+  auto e = std::max(s, to_ns(end));
+  assert((pauses_.empty() || pauses_.back().end <= s) &&
+         "pauses must not overlap");
+  for (size_t k = 0; k < mmu_windows_ns.size(); k++) {
+    auto w = mmu_windows_ns[k];
+    // windows starting at earlier pauses that can't change anymore
+    while (pending_[k] < popped_ + pauses_.size()) {
+      auto from = pauses_[pending_[k] - popped_].start;
+      if (from + w > s) {
+        break;
+      }
+      auto busy = busy_until(from + w) - busy_until(from);
+      auto util = 1.0 - static_cast<double>(busy) / static_cast<double>(w);
+      min_[k] = std::min(min_[k], util);
+      pending_[k]++;
+    }
+  }
+  if (!pauses_.empty() && s - pauses_.back().start < coalesce_ns) {
+    auto &last = pauses_.back();
+    last.end = e;
+    last.busy += e - s;
+    total_busy_ += e - s;
+    // windows ending at the merged pause
+    update_ending_at(e);
+    return;
+  }
+  pauses_.push_back(
+      Pause{.start = s, .end = e, .busy = e - s, .busy_before = total_busy_});
+  total_busy_ += e - s;
+  update_ending_at(e);
+  auto keep_from = *std::min_element(pending_.begin(), pending_.end());
+  auto max_window = mmu_windows_ns.back();
+  while (!pauses_.empty() && popped_ < keep_from &&
+         pauses_.front().end + max_window <= e) {
+    pauses_.pop_front();
+    popped_++;
+  }
+}
+
+void MutatorUtilization::update_ending_at(uint64_t e) {
+  for (size_t k = 0; k < mmu_windows_ns.size(); k++) {
+    auto w = mmu_windows_ns[k];
+    if (e >= w) {
+      auto busy = busy_until(e) - busy_until(e - w);
+      auto util = 1.0 - static_cast<double>(busy) / static_cast<double>(w);
+      min_[k] = std::min(min_[k], util);
+    }
+  }
+}
+
+std::array<double, mmu_windows_ns.size()> MutatorUtilization::get() const {
+  return min_;
+}
+
+uint64_t MutatorUtilization::busy_until(uint64_t t) const {
+  // first pause starting at or after t
+  auto it = std::lower_bound(
+      pauses_.begin(), pauses_.end(), t,
+      [](const Pause &p, uint64_t t) { return p.start < t; });
+  if (it == pauses_.begin()) {
+    return it == pauses_.end() ? total_busy_ : it->busy_before;
+  }
+  auto prev = std::prev(it);
+  // pause time of a merged pause is assumed to come first
+  return prev->busy_before +
+         std::min(std::min(prev->end, t) - prev->start, prev->busy);
+}
+
+} // namespace gc
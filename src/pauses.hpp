@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+namespace gc {
+
+using clock = std::chrono::steady_clock;
+
+uint64_t elapsed_ns(clock::time_point from, clock::time_point to);
+
+// Log-linear latency histogram (4 sub-buckets per power of two, so any
+// reported percentile is at most 25% above the real value).
+struct PauseHistogram {
+  static const size_t n_buckets = 256;
+
+  std::array<uint32_t, n_buckets> buckets{};
+  size_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+
+  void record(uint64_t ns);
+  // upper bound of the bucket containing the p-th percentile (0 <= p <= 1)
+  uint64_t percentile(double p) const;
+};
+
+// Windows used for minimum mutator utilization (MMU).
+constexpr std::array<uint64_t, 4> mmu_windows_ns = {
+    1'000'000,     // 1 ms
+    10'000'000,    // 10 ms
+    100'000'000,   // 100 ms
+    1'000'000'000, // 1 s
+};
+
+// Tracks GC pauses on a timeline and keeps, for every window in
+// mmu_windows_ns, the smallest fraction of the window left to the mutator.
+// Only windows ending at a pause end or starting at a pause start are
+// checked (utilization is minimal at one of them), each one exactly once,
+// using prefix sums of pause time (O(log n) per window).
+//
+// Pauses starting less than coalesce_ns after the start of the previous one
+// are merged into it, keeping their total length, so the timeline holds at
+// most one entry per coalesce_ns however often the mutator is paused. The
+// gaps inside a merged entry may be counted as paused, which lowers the
+// utilization of a window by at most 2 * coalesce_ns / window.
+class MutatorUtilization {
+public:
+  static constexpr uint64_t coalesce_ns = mmu_windows_ns.front() / 100;
+
+  MutatorUtilization();
+
+  void record(clock::time_point start, clock::time_point end);
+  std::array<double, mmu_windows_ns.size()> get() const;
+
+private:
+  struct Pause {
+    uint64_t start;
+    uint64_t end;
+    // time paused between start and end (pauses merged into this one)
+    uint64_t busy;
+    // total pause time before this pause
+    uint64_t busy_before;
+  };
+
+  clock::time_point origin_;
+  std::deque<Pause> pauses_;
+  size_t popped_ = 0;
+  uint64_t total_busy_ = 0;
+  std::array<double, mmu_windows_ns.size()> min_;
+  // sequence number of the first pause whose window-from-start is pending
+  std::array<size_t, mmu_windows_ns.size()> pending_;
+
+  // total pause time before t
+  uint64_t busy_until(uint64_t t) const;
+  // checks the windows ending at e
+  void update_ending_at(uint64_t e);
+};
+
+} // namespace gc
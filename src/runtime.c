@@ -15,7 +15,8 @@ stella_object the_TRUE = { .object_header = TAG_TRUE, .object_fields = {} } ;
 const int FIELD_COUNT_MASK = (1 << 8) - (1 << 4) ;
 const int TAG_MASK         = (1 << 4) - (1 << 0) ;
 
-stella_object* alloc_stella_object(enum TAG tag, int fields_count) {
+// inlined, so that the allocation profiler sees the same frames for both allocation functions
+static inline __attribute__((always_inline)) stella_object* alloc_stella_object_with(void* (*alloc)(size_t), enum TAG tag, int fields_count) {
   stella_object *obj;
   total_allocated_fields += fields_count;
   switch (tag) {
@@ -29,19 +30,37 @@ stella_object* alloc_stella_object(enum TAG tag, int fields_count) {
     // allocate an object with at least one field (or an unknown tag)
     // fall through
     default:
-      obj = gc_alloc(sizeof(stella_object) + fields_count * sizeof(void*));
+      obj = alloc(sizeof(stella_object) + fields_count * STELLA_OBJECT_FIELD_SIZE);
+      gc_profile_alloc(tag, sizeof(stella_object) + fields_count * STELLA_OBJECT_FIELD_SIZE);
       STELLA_OBJECT_INIT_TAG(obj, tag);
       STELLA_OBJECT_INIT_FIELDS_COUNT(obj, fields_count);
       return obj;
   }
 }
 
+stella_object* alloc_stella_object(enum TAG tag, int fields_count) {
+  return alloc_stella_object_with(gc_alloc, tag, fields_count);
+}
+
+int reserve_stella_objects(int count, int fields_count) {
+  if (count <= 0) {
+    return 1;
+  }
+  return gc_reserve(count, sizeof(stella_object) + fields_count * STELLA_OBJECT_FIELD_SIZE);
+}
+
+stella_object* alloc_reserved_stella_object(enum TAG tag, int fields_count) {
+  return alloc_stella_object_with(gc_alloc_reserved, tag, fields_count);
+}
+
 stella_object *nat_to_stella_object(int n) {
   stella_object *result, *x;
   gc_push_root((void*)&result);    // it is sufficient to push only result
   result = &the_ZERO;
+  // one check (and at most one collection) for all cells
+  reserve_stella_objects(n, 1);
   for (int i = n; i > 0; i--) {
-    x = alloc_stella_object(TAG_SUCC, 1);
+    x = alloc_reserved_stella_object(TAG_SUCC, 1);
     STELLA_OBJECT_INIT_FIELD(x, 0, result);
     result = x;
   }
@@ -81,64 +100,137 @@ stella_object* stella_object_nat_rec(stella_object* n, stella_object* z, stella_
   return z;
 }
 
-void print_stella_object(stella_object* obj) {
-  // printf("[%d]", STELLA_OBJECT_HEADER_TAG(obj->object_header));
-  int fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
-  switch (STELLA_OBJECT_HEADER_TAG(obj->object_header)) {
-    case TAG_ZERO:
-      printf("0");
-      return;
-    case TAG_SUCC:
-      printf("%d", stella_object_to_nat(obj));
-      return;
-    case TAG_FALSE:
-      printf("false");
-      return;
-    case TAG_TRUE:
-      printf("true");
-      return;
-    case TAG_FN:
-      printf("fn<%p>", STELLA_OBJECT_READ_FIELD(obj, 0));
-      return;
-    case TAG_REF:
-      printf("ref<%p>", STELLA_OBJECT_READ_FIELD(obj, 0));
-      return;
-    case TAG_UNIT:
-      printf("unit");
-      return;
-    case TAG_INL:
-      printf("inl(");
-      print_stella_object(STELLA_OBJECT_READ_FIELD(obj, 0));
-      printf(")");
-      return;
-    case TAG_INR:
-      printf("inr(");
-      print_stella_object(STELLA_OBJECT_READ_FIELD(obj, 0));
-      printf(")");
-      return;
-    case TAG_EMPTY:
-      printf("[]");
-      return;
-    case TAG_CONS:
-      printf("[");
-      print_stella_object(STELLA_OBJECT_READ_FIELD(obj, 0));
-      obj = STELLA_OBJECT_READ_FIELD(obj, 1);
-      while (STELLA_OBJECT_HEADER_TAG(obj->object_header) == TAG_CONS) {
-        printf(", ");
-        print_stella_object(STELLA_OBJECT_READ_FIELD(obj, 0));
-        obj = STELLA_OBJECT_READ_FIELD(obj, 1);
+/** Output buffer and work stack of fprint_stella_object. */
+typedef struct {
+  FILE *out;
+  char *buffer;
+  size_t buffer_used;
+  /** Pending work: an object to print (text == NULL), a literal text or
+   * the rest of a list (list_rest != 0). */
+  struct print_item { stella_object *obj; const char *text; int list_rest; } *items;
+  size_t items_count;
+  size_t items_capacity;
+} stella_printer;
+
+#define STELLA_PRINT_BUFFER_SIZE (1 << 16)
+
+static void printer_flush(stella_printer *printer) {
+  fwrite(printer->buffer, 1, printer->buffer_used, printer->out);
+  printer->buffer_used = 0;
+}
+
+static void printer_write(stella_printer *printer, const char *text) {
+  for (; *text; text++) {
+    if (printer->buffer_used == STELLA_PRINT_BUFFER_SIZE) {
+      printer_flush(printer);
+    }
+    printer->buffer[printer->buffer_used++] = *text;
+  }
+}
+
+static void printer_push(stella_printer *printer, stella_object *obj, const char *text, int list_rest) {
+  if (printer->items_count == printer->items_capacity) {
+    printer->items_capacity = printer->items_capacity ? 2 * printer->items_capacity : 64;
+    printer->items = realloc(printer->items, printer->items_capacity * sizeof(*printer->items));
+    if (!printer->items) {
+      fprintf(stderr, "[ERROR] out of memory!\n");
+      exit(1);
+    }
+  }
+  struct print_item item = { .obj = obj, .text = text, .list_rest = list_rest };
+  printer->items[printer->items_count++] = item;
+}
+
+void fprint_stella_object(FILE *out, stella_object* obj) {
+  char text[32];
+  stella_printer printer = { .out = out, .buffer = malloc(STELLA_PRINT_BUFFER_SIZE) };
+  if (!printer.buffer) {
+    fprintf(stderr, "[ERROR] out of memory!\n");
+    exit(1);
+  }
+  printer_push(&printer, obj, NULL, 0);
+  while (printer.items_count > 0) {
+    struct print_item item = printer.items[--printer.items_count];
+    if (item.text) {
+      printer_write(&printer, item.text);
+      continue;
+    }
+    obj = item.obj;
+    if (item.list_rest) {
+      if (STELLA_OBJECT_HEADER_TAG(obj->object_header) == TAG_CONS) {
+        printer_write(&printer, ", ");
+        printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, 1), NULL, 1);
+        printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, 0), NULL, 0);
+      } else {
+        printer_write(&printer, "]");
       }
-      printf("]");
-      return;
-    case TAG_TUPLE:
-      printf("{");
-      for (int i = 0; i < fields_count; i++) {
-        print_stella_object(obj->object_fields[i]);
-        if (i < fields_count - 1) { printf(", "); }
+      continue;
+    }
+    int fields_count = STELLA_OBJECT_HEADER_FIELD_COUNT(obj->object_header);
+    switch (STELLA_OBJECT_HEADER_TAG(obj->object_header)) {
+      case TAG_ZERO:
+        printer_write(&printer, "0");
+        break;
+      case TAG_SUCC: {
+        // the chain can't change while it is printed, the barrier on its head
+        // covers the rest
+        size_t n = 1;
+        obj = STELLA_OBJECT_SUCC_ARG(obj);
+        for (; STELLA_OBJECT_HEADER_TAG(obj->object_header) == TAG_SUCC; n++) {
+          obj = (stella_object*)STELLA_OBJECT_LOAD(obj, 0);
+        }
+        snprintf(text, sizeof(text), "%zu", n);
+        printer_write(&printer, text);
+        break;
       }
-      printf("}");  // TODO: pretty print a tuple
-      return;
+      case TAG_FALSE:
+        printer_write(&printer, "false");
+        break;
+      case TAG_TRUE:
+        printer_write(&printer, "true");
+        break;
+      case TAG_FN:
+        snprintf(text, sizeof(text), "fn<%p>", (void*)STELLA_OBJECT_READ_FIELD(obj, 0));
+        printer_write(&printer, text);
+        break;
+      case TAG_REF:
+        snprintf(text, sizeof(text), "ref<%p>", (void*)STELLA_OBJECT_READ_FIELD(obj, 0));
+        printer_write(&printer, text);
+        break;
+      case TAG_UNIT:
+        printer_write(&printer, "unit");
+        break;
+      case TAG_INL:
+      case TAG_INR:
+        printer_write(&printer, STELLA_OBJECT_HEADER_TAG(obj->object_header) == TAG_INL ? "inl(" : "inr(");
+        printer_push(&printer, NULL, ")", 0);
+        printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, 0), NULL, 0);
+        break;
+      case TAG_EMPTY:
+        printer_write(&printer, "[]");
+        break;
+      case TAG_CONS:
+        printer_write(&printer, "[");
+        printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, 1), NULL, 1);
+        printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, 0), NULL, 0);
+        break;
+      case TAG_TUPLE:
+        printer_write(&printer, "{");
+        printer_push(&printer, NULL, "}", 0);  // TODO: pretty print a tuple
+        for (int i = fields_count - 1; i >= 0; i--) {
+          printer_push(&printer, STELLA_OBJECT_READ_FIELD(obj, i), NULL, 0);
+          if (i > 0) { printer_push(&printer, NULL, ", ", 0); }
+        }
+        break;
+    }
   }
+  printer_flush(&printer);
+  free(printer.items);
+  free(printer.buffer);
+}
+
+void print_stella_object(stella_object* obj) {
+  fprint_stella_object(stdout, obj);
 }
 
 void print_stella_stats() {
@@ -152,4 +244,9 @@ void print_stella_stats() {
   printf("Stella runtime statistics:\n");
   printf("Total allocated fields in Stella objects: %'d fields\n", total_allocated_fields);
   #endif
+  #ifdef STELLA_ALLOC_PROFILE
+  printf("\n------------------------------------------------------------\n");
+  printf("Sampled allocation sites (collapsed stacks, bytes):\n");
+  print_gc_alloc_profile(stdout);
+  #endif
 }
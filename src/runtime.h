@@ -17,12 +17,25 @@ typedef struct {
   void*  object_fields[0];  /**< An array of object fields (0 fields for static objects). */
 } stella_object;
 
+/** With STELLA_COMPRESSED_REFS, fields of heap objects are 32-bit references
+ * instead of pointers (see gc_load_field).
+ */
+#ifdef STELLA_COMPRESSED_REFS
+#define STELLA_OBJECT_FIELD_SIZE 4
+#define STELLA_OBJECT_LOAD(obj, i) gc_load_field(obj, i)
+#define STELLA_OBJECT_STORE(obj, i, x) gc_store_field(obj, i, (void*)(x))
+#else
+#define STELLA_OBJECT_FIELD_SIZE sizeof(void*)
+#define STELLA_OBJECT_LOAD(obj, i) (obj->object_fields[i])
+#define STELLA_OBJECT_STORE(obj, i, x) (obj->object_fields[i] = (void*)(x))
+#endif
+
 /** Read a field from a Stella object. Subject to a read barrier. */
-#define STELLA_OBJECT_READ_FIELD(obj, i) GC_READ_BARRIER(obj, i, ((stella_object*)(obj->object_fields[i])))
+#define STELLA_OBJECT_READ_FIELD(obj, i) GC_READ_BARRIER(obj, i, ((stella_object*)STELLA_OBJECT_LOAD(obj, i)))
 /** (Over)write a field from a Stella object. Subject to a write barrier.
  * See STELLA_OBJECT_INIT_FIELD for initialization of fields (which does not trigger the write barrier).
  */
-#define STELLA_OBJECT_WRITE_FIELD(obj, i, x) GC_WRITE_BARRIER(obj, i, x, (obj->object_fields[i] = (void*)x))
+#define STELLA_OBJECT_WRITE_FIELD(obj, i, x) GC_WRITE_BARRIER(obj, i, x, STELLA_OBJECT_STORE(obj, i, x))
 
 /** Extract the TAG from Stella object's header. */
 #define STELLA_OBJECT_HEADER_TAG(header) (header & TAG_MASK)
@@ -37,7 +50,7 @@ typedef struct {
 /** Initialize new Stella object's fields count. */
 #define STELLA_OBJECT_INIT_FIELDS_COUNT(obj, count) (obj->object_header = ((obj->object_header & ~(((1 << 4) - 1) << 4)) | count << 4))
 /** Initialize new Stella object's field. */
-#define STELLA_OBJECT_INIT_FIELD(obj, i, x) (obj->object_fields[i] = (void*)x)
+#define STELLA_OBJECT_INIT_FIELD(obj, i, x) STELLA_OBJECT_STORE(obj, i, x)
 
 /** Call a Stella function (closure) with a given Stella object as an argument. */
 #define STELLA_OBJECT_CLOSURE_CALL(f, x) (*(stella_object *(*)(stella_object *, stella_object *))STELLA_OBJECT_READ_FIELD(f, 0))(f, x)
@@ -72,6 +85,33 @@ enum TAG {
  * Note that this function makes use of gc_alloc.
  */
 stella_object* alloc_stella_object(enum TAG tag, int fields_count);
+/** Reserve room for count objects with fields_count fields each (see gc_reserve),
+ * to be allocated with alloc_reserved_stella_object without checks or collections.
+ * Returns 0 if no room could be reserved.
+ */
+int reserve_stella_objects(int count, int fields_count);
+/** Same as alloc_stella_object, but uses the room reserved by reserve_stella_objects (gc_alloc_reserved). */
+stella_object* alloc_reserved_stella_object(enum TAG tag, int fields_count);
+
+/** Name of a Stella object tag (e.g. "TAG_SUCC").
+ * Inline so that tools reading heap snapshots print the same names. */
+static inline const char* stella_tag_name(enum TAG tag) {
+  switch (tag) {
+    case TAG_ZERO: return "TAG_ZERO";
+    case TAG_SUCC: return "TAG_SUCC";
+    case TAG_FALSE: return "TAG_FALSE";
+    case TAG_TRUE: return "TAG_TRUE";
+    case TAG_FN: return "TAG_FN";
+    case TAG_REF: return "TAG_REF";
+    case TAG_UNIT: return "TAG_UNIT";
+    case TAG_TUPLE: return "TAG_TUPLE";
+    case TAG_INL: return "TAG_INL";
+    case TAG_INR: return "TAG_INR";
+    case TAG_EMPTY: return "TAG_EMPTY";
+    case TAG_CONS: return "TAG_CONS";
+  }
+  return "TAG_UNKNOWN";
+}
 
 /** Convert a natural number (non-negative integer) into a corresponding Stella object. */
 stella_object *nat_to_stella_object(int n);
@@ -79,6 +119,11 @@ stella_object *nat_to_stella_object(int n);
 int stella_object_to_nat(stella_object* obj);
 /** Pretty-print a Stella object. */
 void print_stella_object(stella_object* obj);
+/** Pretty-print a Stella object to a file. Works without recursion and
+ * writes in large chunks, so huge or deeply nested results can be streamed.
+ * The object must not change while it is printed (nothing is allocated).
+ */
+void fprint_stella_object(FILE *out, stella_object* obj);
 /** Print some Stella runtime statistics. */
 void print_stella_stats();
 
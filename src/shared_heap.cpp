@@ -0,0 +1,399 @@
+#include "shared_heap.hpp"
+
+#include <assert.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <limits>
+#include <system_error>
+
+namespace gc {
+
+SharedHeap::SharedHeap(size_t max_memory, bool merge_blocks,
+                       bool skip_first_field, bool incremental,
+                       size_t tlab_size, size_t min_heap_size,
+                       HeapSizingOptions sizing_options,
+                       HugePages huge_pages, bool merged_header,
+                       bool compressed_refs)
+    : collector_(max_memory, merge_blocks, skip_first_field, incremental,
+                 huge_pages, merged_header, compressed_refs),
+      tlab_size_(incremental ? 0 : tlab_size),
+      last_collection_end_(clock::now()) {
+  collector_.defer_phase_changes(true);
+  if (!incremental && min_heap_size > 0) {
+    sizing_.emplace(min_heap_size, max_memory, sizing_options);
+  }
+  publish();
+}
+
+// An address below the caller's frame. Callers that stop for a collection
+// record it as the top of their stack after __builtin_unwind_init (which
+// spills all registers in their frame), so that the stack scan sees every
+// value their callers held.
+[[gnu::noinline]] static const void *stack_top() {
+  return __builtin_frame_address(0);
+}
+
+// highest address of the calling thread's stack
+static const void *stack_base() {
+  pthread_attr_t attr;
+  if (auto err = pthread_getattr_np(pthread_self(), &attr)) {
+    throw std::system_error(err, std::generic_category(),
+                            "pthread_getattr_np");
+  }
+  void *addr;
+  size_t size;
+  pthread_attr_getstack(&attr, &addr, &size);
+  pthread_attr_destroy(&attr);
+  return static_cast<unsigned char *>(addr) + size;
+}
+
+void SharedHeap::enable_conservative_roots() {
+  std::lock_guard lock(mutex_);
+  assert(mutators_.empty() && "mutators are registered already");
+  collector_.enable_conservative_roots();
+}
+
+size_t SharedHeap::heap_limit() const {
+  return sizing_ ? sizing_->limit() : collector_.max_memory;
+}
+
+SharedHeap::Mutator::Mutator(SharedHeap &heap) : heap_(heap) {
+  if (heap_.collector_.conservative_roots()) {
+    stack_base_ = stack_base();
+  }
+  std::unique_lock lock(heap_.mutex_);
+  // don't join in the middle of a collection
+  heap_.changed_.wait(lock, [this] { return !heap_.stop_requested_; });
+  heap_.mutators_.push_back(this);
+  heap_.collector_.add_root_stack(&roots_);
+}
+
+SharedHeap::Mutator::~Mutator() {
+  std::unique_lock lock(heap_.mutex_);
+  if (blocking_ > 0) {
+    // already counted as parked
+    heap_.changed_.wait(lock, [this] { return !heap_.stop_requested_; });
+    heap_.parked_--;
+  } else {
+    heap_.park(this, lock);
+  }
+  heap_.retire(this);
+  heap_.collector_.remove_root_stack(&roots_);
+  auto &mutators = heap_.mutators_;
+  mutators.erase(std::find(mutators.begin(), mutators.end(), this));
+  // a collection may be waiting for this mutator
+  heap_.changed_.notify_all();
+}
+
+void *SharedHeap::Mutator::allocate(size_t bytes) {
+  safepoint();
+  if (auto obj = MarkAndSweep::allocate_in_tlab(tlab_, bytes)) {
+    return obj;
+  }
+  return heap_.allocate_slow(this, bytes);
+}
+
+bool SharedHeap::Mutator::reserve(size_t count, size_t bytes) {
+  safepoint();
+  if (heap_.incremental()) {
+    return false;
+  }
+  auto block_size =
+      MarkAndSweep::block_size_for(bytes, heap_.collector_.merged_header);
+  if (count > std::numeric_limits<size_t>::max() / block_size) {
+    return false;
+  }
+  if (count * block_size <= static_cast<size_t>(tlab_.end - tlab_.top)) {
+    return true;
+  }
+  return heap_.reserve_slow(this, count * block_size);
+}
+
+void SharedHeap::Mutator::collect() {
+  heap_.stop_the_world(this, [this](MarkAndSweep &collector) {
+    heap_.collect(collector);
+  });
+}
+
+void *SharedHeap::Mutator::collect_and_allocate(size_t bytes) {
+  void *obj = nullptr;
+  heap_.stop_the_world(this, [&](MarkAndSweep &collector) {
+    heap_.collect(collector);
+    obj = heap_.allocate_locked(this, bytes);
+  });
+  return obj;
+}
+
+bool SharedHeap::Mutator::step(size_t bytes, clock::time_point deadline) {
+  bool finished = false;
+  heap_.stop_the_world(this, [&](MarkAndSweep &collector) {
+    if (collector.incremental) {
+      finished = collector.step(bytes, deadline);
+    } else if (heap_.sizing_ &&
+               heap_.sizing_->should_collect(collector.bytes_used())) {
+      heap_.collect(collector);
+      finished = true;
+    }
+  });
+  return finished;
+}
+
+void *SharedHeap::Mutator::finish_cycle_and_allocate(size_t bytes) {
+  void *obj = nullptr;
+  heap_.stop_the_world(this, [&](MarkAndSweep &collector) {
+    collector.finish_cycle();
+    obj = heap_.allocate_locked(this, bytes);
+  });
+  return obj;
+}
+
+std::vector<void *> SharedHeap::Mutator::load_image(int fd,
+                                                    const void *external_base) {
+  std::vector<void *> roots;
+  heap_.stop_the_world(this, [&](MarkAndSweep &collector) {
+    roots = collector.load_image(fd, external_base);
+    if (heap_.sizing_) {
+      heap_.sizing_->collected(collector.bytes_used(), 0, 0);
+    }
+  });
+  return roots;
+}
+
+void SharedHeap::Mutator::push_root(void **root) {
+  auto lock = heap_.lock_if_incremental();
+  heap_.collector_.push_root(roots_, root);
+}
+
+void SharedHeap::Mutator::pop_root(void **root) {
+  auto lock = heap_.lock_if_incremental();
+  heap_.collector_.pop_root(roots_, root);
+}
+
+void SharedHeap::Mutator::read(void *obj) {
+  auto lock = heap_.lock_if_incremental();
+  if (lock) {
+    heap_.collector_.read(obj);
+  } else {
+    reads_++;
+  }
+}
+
+void SharedHeap::Mutator::write(void *obj, void *contents) {
+  auto lock = heap_.lock_if_incremental();
+  if (lock) {
+    heap_.collector_.write(obj, contents);
+  } else {
+    writes_++;
+  }
+}
+
+void SharedHeap::Mutator::enter_blocking() {
+  if (blocking_++ > 0) {
+    return;
+  }
+  __builtin_unwind_init();
+  stack_top_ = stack_top();
+  std::lock_guard lock(heap_.mutex_);
+  heap_.parked_++;
+  heap_.changed_.notify_all();
+}
+
+void SharedHeap::Mutator::leave_blocking() {
+  assert(blocking_ > 0);
+  if (--blocking_ > 0) {
+    return;
+  }
+  std::unique_lock lock(heap_.mutex_);
+  heap_.changed_.wait(lock, [this] { return !heap_.stop_requested_; });
+  assert(heap_.parked_ > 0);
+  heap_.parked_--;
+}
+
+void SharedHeap::stop_the_world(
+    Mutator *self, const std::function<void(MarkAndSweep &)> &f) {
+  if (self) {
+    __builtin_unwind_init();
+    self->stack_top_ = stack_top();
+  }
+  std::unique_lock lock(mutex_);
+  // let a collection started by another thread finish first
+  park(self, lock);
+  stop_requested_ = true;
+  changed_.wait(lock, [this, self] {
+    return parked_ + (self ? 1 : 0) == mutators_.size();
+  });
+  for (auto mutator : mutators_) {
+    retire(mutator);
+  }
+  if (collector_.conservative_roots()) {
+    std::vector<MarkAndSweep::MemoryRange> stacks;
+    for (auto mutator : mutators_) {
+      if (mutator->stack_top_) {
+        stacks.push_back({mutator->stack_top_, mutator->stack_base_});
+      }
+    }
+    collector_.scan_conservative_roots(stacks);
+  }
+  struct Restart {
+    SharedHeap &heap;
+
+    ~Restart() {
+      heap.collector_.clear_conservative_roots();
+      heap.publish();
+      heap.stop_requested_ = false;
+      heap.changed_.notify_all();
+    }
+  } restart{*this};
+  f(collector_);
+}
+
+void *SharedHeap::allocate_slow(Mutator *self, size_t bytes) {
+  std::unique_lock lock(mutex_);
+  park(self, lock);
+  if (collector_.phase_change_pending()) {
+    // this thread is at a safepoint, stop the others at theirs
+    lock.unlock();
+    stop_the_world(self, [](MarkAndSweep &collector) {
+      if (collector.phase_change_pending()) {
+        collector.change_phase();
+      }
+    });
+    lock.lock();
+    park(self, lock);
+  }
+  collect_if_due(self, lock);
+  return allocate_locked(self, bytes);
+}
+
+void *SharedHeap::allocate_locked(Mutator *self, size_t bytes) {
+  // larger objects would waste too much of a buffer
+  if (tlab_size_ > 0 && bytes <= tlab_size_ / 4 && tlabs_fit()) {
+    collector_.retire_tlab(self->tlab_);
+    if (collector_.refill_tlab(self->tlab_, tlab_size_)) {
+      auto obj = MarkAndSweep::allocate_in_tlab(self->tlab_, bytes);
+      assert(obj != nullptr);
+      return obj;
+    }
+  }
+  return collector_.allocate(bytes);
+}
+
+bool SharedHeap::reserve_slow(Mutator *self, size_t bytes) {
+  if (bytes > collector_.max_memory) {
+    // would never fit, not worth a collection
+    return false;
+  }
+  std::unique_lock lock(mutex_);
+  park(self, lock);
+  auto collected = collect_if_due(self, lock);
+  auto buffer_size = std::max(tlab_size_, bytes);
+  collector_.retire_tlab(self->tlab_);
+  if (collector_.refill_tlab(self->tlab_, buffer_size)) {
+    return true;
+  }
+  // Another collection would free nothing more, and if there is enough free
+  // memory only a large enough block is missing: the objects are allocated
+  // one by one instead.
+  if (collected || collector_.bytes_free() >= bytes) {
+    return false;
+  }
+  lock.unlock();
+  bool reserved = false;
+  stop_the_world(self, [&](MarkAndSweep &collector) {
+    collect(collector);
+    reserved = collector.refill_tlab(self->tlab_, buffer_size);
+  });
+  return reserved;
+}
+
+bool SharedHeap::collect_if_due(Mutator *self,
+                                std::unique_lock<std::mutex> &lock) {
+  if (!sizing_ || !sizing_->should_collect(collector_.bytes_used())) {
+    return false;
+  }
+  bool collected = false;
+  lock.unlock();
+  stop_the_world(self, [this, &collected](MarkAndSweep &collector) {
+    // unless another thread just collected
+    if (sizing_->should_collect(collector.bytes_used())) {
+      collect(collector);
+      collected = true;
+    }
+  });
+  lock.lock();
+  park(self, lock);
+  return collected;
+}
+
+void SharedHeap::collect(MarkAndSweep &collector) {
+  auto start = clock::now();
+  collector.collect();
+  auto end = clock::now();
+  if (sizing_) {
+    sizing_->collected(collector.bytes_used(), elapsed_ns(start, end),
+                       elapsed_ns(last_collection_end_, end));
+  }
+  last_collection_end_ = end;
+}
+
+void SharedHeap::park(Mutator *self) {
+  std::unique_lock lock(mutex_);
+  park(self, lock);
+}
+
+void SharedHeap::park(Mutator *self, std::unique_lock<std::mutex> &lock) {
+  if (!stop_requested_) {
+    return;
+  }
+  if (self) {
+    __builtin_unwind_init();
+    self->stack_top_ = stack_top();
+    parked_++;
+    changed_.notify_all();
+  }
+  changed_.wait(lock, [this] { return !stop_requested_; });
+  if (self) {
+    parked_--;
+  }
+}
+
+std::unique_lock<std::mutex> SharedHeap::lock_if_incremental() {
+  if (collector_.incremental) {
+    return std::unique_lock(mutex_);
+  }
+  return {};
+}
+
+SharedHeap::PublishedStats SharedHeap::published_stats() const {
+  std::lock_guard lock(published_mutex_);
+  return published_;
+}
+
+Census SharedHeap::published_census() const {
+  std::lock_guard lock(published_mutex_);
+  return published_census_;
+}
+
+void SharedHeap::publish() {
+  PublishedStats published{collector_.get_stats(), heap_limit()};
+  std::lock_guard lock(published_mutex_);
+  published_ = published;
+  // a census only changes when a collection finishes
+  if (collector_.census().collection != published_census_.collection) {
+    published_census_ = collector_.census();
+  }
+}
+
+bool SharedHeap::tlabs_fit() const {
+  return tlab_size_ * mutators_.size() * tlab_heap_fraction <= heap_limit();
+}
+
+void SharedHeap::retire(Mutator *mutator) {
+  collector_.retire_tlab(mutator->tlab_);
+  collector_.count_accesses(mutator->reads_, mutator->writes_);
+  mutator->reads_ = 0;
+  mutator->writes_ = 0;
+}
+
+} // namespace gc
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "heap_sizing.hpp"
+#include "mark_and_sweep.hpp"
+
+namespace gc {
+
+// A collector shared by several mutator threads.
+//
+// Every thread works through its own Mutator, which has a private root stack
+// and a thread-local allocation buffer (TLAB), so root push/pop and most
+// allocations take no lock. Only refilling a buffer (or allocating an object
+// too large for one) locks the heap.
+//
+// Collections stop the world: the collecting thread raises a flag that
+// mutators poll at safepoints and waits until every other mutator is parked,
+// then retires all buffers. Safepoints are allocations: generated code only
+// guarantees that live objects are rooted there (a fresh object is often
+// held in a local across gc_pop_root), so root push/pop doesn't poll. A
+// thread that runs for long without allocating should call safepoint(), a
+// thread that blocks outside of the runtime (I/O, waiting for other threads)
+// must enter a blocking region, or collections will wait for it.
+//
+// With a minimum heap size, full collections are triggered by a HeapSizing
+// policy (checked when a buffer is refilled) before the heap runs out.
+//
+// With conservative roots the stacks of all mutators are scanned whenever the
+// world is stopped (see MarkAndSweep::enable_conservative_roots), so objects
+// don't have to be rooted. Registers are spilled to the stack where a thread
+// stops: at a safepoint, when it stops the world or enters a blocking region.
+// The part of its stack above that point is all that's scanned, so objects
+// held only by the frames a thread runs inside a blocking region are missed.
+//
+// In incremental mode collector work happens on every allocation and
+// barrier, so all mutator operations are serialized by the heap lock. Steps
+// may run while other threads hold unrooted objects, so the end of marking
+// (root rescan) and of sweeping (restart from roots) stop the world.
+class SharedHeap {
+public:
+  class Mutator {
+  public:
+    // registers a mutator for the calling thread
+    explicit Mutator(SharedHeap &heap);
+    ~Mutator();
+
+    Mutator(const Mutator &) = delete;
+    Mutator &operator=(const Mutator &) = delete;
+
+    // nullptr if out of memory (no collection is started)
+    void *allocate(size_t bytes);
+    // Makes room in the buffer for `count` objects of `bytes` bytes (with at
+    // most one collection), so that allocate_reserved returns them. False if
+    // out of memory, if only a large enough free block is missing (no
+    // collection then) or in incremental mode (no buffers).
+    bool reserve(size_t count, size_t bytes);
+    // from the buffer only, no safepoint (nullptr if it doesn't fit)
+    void *allocate_reserved(size_t bytes) {
+      return MarkAndSweep::allocate_in_tlab(tlab_, bytes);
+    }
+    // full stop-the-world collection
+    void collect();
+    // Collects and allocates before the other threads restart, so that they
+    // can't take the memory freed for this allocation. nullptr if still out
+    // of memory.
+    void *collect_and_allocate(size_t bytes);
+    // Collector work ahead of time (e.g. when idle), with the world stopped:
+    // a MarkAndSweep::step in incremental mode, otherwise the collection the
+    // sizing policy would start at the next buffer refill (if any). Returns
+    // true if a cycle or collection finished.
+    bool step(size_t bytes, clock::time_point deadline);
+    // incremental mode: finishes the cycle in progress with the world
+    // stopped (see MarkAndSweep::finish_cycle), then allocates like
+    // collect_and_allocate
+    void *finish_cycle_and_allocate(size_t bytes);
+    // Loads an image into the empty heap with the world stopped (see
+    // MarkAndSweep::load_image) and returns its roots. The sizing policy
+    // treats the image like the survivors of a collection.
+    std::vector<void *> load_image(int fd, const void *external_base);
+
+    void push_root(void **root);
+    void pop_root(void **root);
+
+    void read(void *obj);
+    void write(void *obj, void *contents);
+
+    // the heap must not be accessed inside a blocking region, regions nest
+    void enter_blocking();
+    void leave_blocking();
+
+    void safepoint() {
+      if (heap_.stop_requested_.load(std::memory_order_relaxed)) {
+        heap_.park(this);
+      }
+    }
+
+  private:
+    friend class SharedHeap;
+
+    SharedHeap &heap_;
+    MarkAndSweep::RootStack roots_;
+    MarkAndSweep::Tlab tlab_;
+    // depth of nested blocking regions
+    size_t blocking_ = 0;
+    // with conservative roots: the scanned part of the thread's stack, the
+    // top is where the thread stopped last
+    const void *stack_base_ = nullptr;
+    const void *stack_top_ = nullptr;
+    // flushed to the collector when the world is stopped
+    size_t reads_ = 0;
+    size_t writes_ = 0;
+  };
+
+  // Buffers are `tlab_size` bytes (0 disables them, as does incremental
+  // mode, see lock_if_incremental). The heap limit starts at `min_heap_size`
+  // (0 = no sizing policy, collect when allocation fails, always the case in
+  // incremental mode). See MarkAndSweep for `huge_pages`, `merged_header`
+  // and `compressed_refs`.
+  SharedHeap(size_t max_memory, bool merge_blocks, bool skip_first_field,
+             bool incremental, size_t tlab_size, size_t min_heap_size = 0,
+             HeapSizingOptions sizing_options = {},
+             HugePages huge_pages = HugePages::NONE,
+             bool merged_header = false, bool compressed_refs = false);
+
+  bool incremental() const { return collector_.incremental; }
+  // must be called before the first mutator registers
+  void enable_conservative_roots();
+  // only the parts that never change (options, compressed references) and
+  // the address range may be used without stopping the world, the range
+  // only changes in load_image, while the calling thread is stopped if it
+  // runs on this heap
+  const MarkAndSweep &collector() const { return collector_; }
+  // current limit of the sizing policy (max_memory without one), only valid
+  // with the world stopped
+  size_t heap_limit() const;
+
+  // Runs f with all other mutators parked and all buffers retired, `self` is
+  // the mutator of the calling thread (nullptr if it has none). The world is
+  // restarted even if f throws.
+  void stop_the_world(Mutator *self,
+                      const std::function<void(MarkAndSweep &)> &f);
+
+  // Statistics as of the last time the world was stopped (every full
+  // collection, gc_step, phase change of an incremental cycle, ...), any
+  // thread can read them without stopping the world.
+  struct PublishedStats {
+    Stats stats;
+    size_t heap_limit;
+  };
+  PublishedStats published_stats() const;
+  Census published_census() const;
+
+private:
+  // Free memory in a thread's buffer can't be allocated by other threads:
+  // buffers are only refilled while all of them together take at most this
+  // part of the current heap limit, so small heaps go without them.
+  static constexpr size_t tlab_heap_fraction = 16;
+
+  MarkAndSweep collector_;
+  const size_t tlab_size_;
+
+  // guards the collector (except buffers in use) and the fields below
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::atomic<bool> stop_requested_ = false;
+  std::optional<HeapSizing> sizing_;
+  clock::time_point last_collection_end_;
+  std::vector<Mutator *> mutators_;
+  // mutators waiting at a safepoint or in a blocking region
+  size_t parked_ = 0;
+
+  // guards the fields below, never taken by mutators
+  mutable std::mutex published_mutex_;
+  PublishedStats published_;
+  Census published_census_;
+
+  void *allocate_slow(Mutator *self, size_t bytes);
+  // from a new buffer or the collector, with the lock held or the world
+  // stopped
+  void *allocate_locked(Mutator *self, size_t bytes);
+  // refills the buffer of `self` with at least `bytes` bytes
+  bool reserve_slow(Mutator *self, size_t bytes);
+  // collects if the sizing policy says so, returns true if it did
+  bool collect_if_due(Mutator *self, std::unique_lock<std::mutex> &lock);
+  // collects with the world stopped and updates the sizing policy
+  void collect(MarkAndSweep &collector);
+  void park(Mutator *self);
+  void park(Mutator *self, std::unique_lock<std::mutex> &lock);
+  // Empty unless in incremental mode. Incremental barriers, roots and
+  // allocations all go through the collector under this lock, so mutators
+  // of an incremental heap don't run in parallel on the heap (and there are
+  // no buffers): threads only scale in full mode.
+  std::unique_lock<std::mutex> lock_if_incremental();
+  // see tlab_heap_fraction, with the lock held or the world stopped
+  bool tlabs_fit() const;
+  void retire(Mutator *mutator);
+  // with the world stopped
+  void publish();
+};
+
+} // namespace gc
@@ -0,0 +1,199 @@
+#include "snapshot.hpp"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace gc {
+
+// same as TAG_MASK in runtime.h
+const uint64_t stella_tag_mask = (1 << 4) - 1;
+// same as MarkAndSweep::external_ref_bit
+const uint32_t compressed_external_bit = uint32_t(1) << 31;
+
+Snapshot::Snapshot(std::span<const unsigned char> data) : data_(data) {
+  if (data_.size() < sizeof(SnapshotHeader)) {
+    throw std::runtime_error("snapshot is too small");
+  }
+  header_ = reinterpret_cast<const SnapshotHeader *>(data_.data());
+  if (std::memcmp(header_->magic, SnapshotHeader::expected_magic,
+                  sizeof(header_->magic)) != 0) {
+    throw std::runtime_error("not a heap snapshot");
+  }
+  if (header_->version != SnapshotHeader::current_version) {
+    throw std::runtime_error("unsupported snapshot version");
+  }
+  if (header_->metadata_size != sizeof(SnapshotMetadata)) {
+    throw std::runtime_error("unsupported block metadata layout");
+  }
+  auto fits = [this](uint64_t offset, uint64_t n, uint64_t size) {
+    return offset % 8 == 0 && offset <= data_.size() &&
+           n <= (data_.size() - offset) / size;
+  };
+  if (!fits(header_->roots_offset, header_->n_roots, sizeof(SnapshotRoot)) ||
+      !fits(header_->freelist_offset, header_->n_free_blocks,
+            sizeof(uint64_t)) ||
+      !fits(header_->space_offset, header_->space_size, 1)) {
+    throw std::runtime_error("snapshot is truncated");
+  }
+}
+
+const SnapshotHeader &Snapshot::header() const { return *header_; }
+
+std::span<const SnapshotRoot> Snapshot::roots() const {
+  return {reinterpret_cast<const SnapshotRoot *>(&data_[header_->roots_offset]),
+          header_->n_roots};
+}
+
+std::span<const uint64_t> Snapshot::freelist() const {
+  return {reinterpret_cast<const uint64_t *>(&data_[header_->freelist_offset]),
+          header_->n_free_blocks};
+}
+
+bool Snapshot::is_in_space(uint64_t address) const {
+  return header_->space_start + header_->metadata_size <= address &&
+         address < header_->space_start + header_->space_size &&
+         address % sizeof(uint64_t) == 0;
+}
+
+const SnapshotMetadata &Snapshot::metadata(uint64_t address) const {
+  assert(is_in_space(address));
+  auto idx = address - header_->space_start - header_->metadata_size;
+  return *reinterpret_cast<const SnapshotMetadata *>(
+      &data_[header_->space_offset + idx]);
+}
+
+uint64_t Snapshot::field(uint64_t address, size_t i) const {
+  assert(i < field_count(address));
+  auto idx = address - header_->space_start;
+  if (!(header_->flags & SnapshotHeader::FLAG_COMPRESSED_REFS)) {
+    return *reinterpret_cast<const uint64_t *>(
+        &data_[header_->space_offset + idx + i * sizeof(uint64_t)]);
+  }
+  auto ref = *reinterpret_cast<const uint32_t *>(
+      &data_[header_->space_offset + idx + i * sizeof(uint32_t)]);
+  if (ref == 0 || (ref & compressed_external_bit)) {
+    return 0;
+  }
+  return header_->space_start + (ref - 1) * sizeof(uint64_t);
+}
+
+size_t Snapshot::field_count(uint64_t address) const {
+  auto field_size = header_->flags & SnapshotHeader::FLAG_COMPRESSED_REFS
+                        ? sizeof(uint32_t)
+                        : sizeof(uint64_t);
+  return (metadata(address).block_size - header_->metadata_size) /
+         field_size;
+}
+
+std::vector<SnapshotBlock> Snapshot::blocks() const {
+  std::vector<SnapshotBlock> res;
+  auto end = header_->space_start + header_->space_size;
+  auto p = header_->space_start + header_->metadata_size;
+  while (p < end) {
+    auto &meta = metadata(p);
+    if (meta.block_size <= header_->metadata_size ||
+        meta.block_size % sizeof(uint64_t) != 0 ||
+        p - header_->metadata_size + meta.block_size > end) {
+      throw std::runtime_error("corrupted block metadata");
+    }
+    res.push_back(SnapshotBlock{.address = p,
+                                .block_size = meta.block_size,
+                                .free = meta.mark == SnapshotMetadata::FREE});
+    p += meta.block_size;
+  }
+  return res;
+}
+
+std::vector<uint64_t> Snapshot::reachable() const {
+  // only pointers to the start of a used block are followed
+  std::vector<bool> used(header_->space_size / sizeof(uint64_t));
+  for (auto &block : blocks()) {
+    used[(block.address - header_->space_start) / sizeof(uint64_t)] =
+        !block.free;
+  }
+  std::vector<bool> visited(used.size());
+  std::vector<uint64_t> res;
+  std::vector<uint64_t> stack;
+  auto visit = [&](uint64_t x) {
+    if (!is_in_space(x)) {
+      return;
+    }
+    auto i = (x - header_->space_start) / sizeof(uint64_t);
+    if (!used[i] || visited[i]) {
+      return;
+    }
+    visited[i] = true;
+    res.push_back(x);
+    stack.push_back(x);
+  };
+  // values point at the metadata with merged headers
+  uint64_t offset = header_->flags & SnapshotHeader::FLAG_MERGED_HEADER
+                        ? header_->metadata_size
+                        : 0;
+  for (auto &root : roots()) {
+    visit(root.value + offset);
+  }
+  size_t first_field =
+      header_->flags & SnapshotHeader::FLAG_SKIP_FIRST_FIELD ? 1 : 0;
+  while (!stack.empty()) {
+    auto x = stack.back();
+    stack.pop_back();
+    auto n = field_count(x);
+    for (size_t i = first_field; i < n; i++) {
+      visit(field(x, i) + offset);
+    }
+  }
+  return res;
+}
+
+Snapshot::Summary Snapshot::summary() const {
+  Summary res{};
+  for (auto &block : blocks()) {
+    if (block.free) {
+      res.n_blocks_free++;
+      res.bytes_free += block.block_size;
+      res.largest_free_block =
+          std::max<size_t>(res.largest_free_block, block.block_size);
+    } else {
+      res.n_blocks_used++;
+      res.bytes_used += block.block_size;
+    }
+  }
+  for (auto x : reachable()) {
+    res.n_reachable++;
+    res.bytes_reachable += metadata(x).block_size;
+  }
+  return res;
+}
+
+std::map<int, Snapshot::TypeStats> Snapshot::type_stats() const {
+  std::map<int, TypeStats> res;
+  bool merged = header_->flags & SnapshotHeader::FLAG_MERGED_HEADER;
+  for (auto x : reachable()) {
+    auto tag = merged ? static_cast<int>(metadata(x).header & stella_tag_mask)
+               : field_count(x) > 0
+                   ? static_cast<int>(field(x, 0) & stella_tag_mask)
+                   : -1;
+    auto &stats = res[tag];
+    stats.objects++;
+    stats.bytes += metadata(x).block_size;
+  }
+  return res;
+}
+
+std::map<size_t, Snapshot::TypeStats> Snapshot::size_stats() const {
+  std::map<size_t, TypeStats> res;
+  for (auto &block : blocks()) {
+    if (!block.free) {
+      auto &stats = res[block.block_size];
+      stats.objects++;
+      stats.bytes += block.block_size;
+    }
+  }
+  return res;
+}
+
+} // namespace gc
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace gc {
+
+// BINARY HEAP SNAPSHOT
+// all values are native-endian, all sections aligned to 8 bytes
+//
+//   SnapshotHeader
+//   SnapshotRoot     [n_roots]        at roots_offset
+//   uint64_t         [n_free_blocks]  at freelist_offset (freelist order)
+//   raw heap space   [space_size]     at space_offset (page aligned)
+//
+// The heap section is a byte-for-byte copy of the collector space (block
+// metadata included), so it can be mmap'ed and walked in place. Pointers
+// keep their original values, space_start maps them to the heap section.
+//
+// A heap image (FLAG_IMAGE, see MarkAndSweep::write_image) has the same
+// layout, but its roots are the ones it was written with (address = index)
+// and its heap section ends with the last used block.
+
+struct SnapshotHeader {
+  static constexpr char expected_magic[8] = {'L', 'I', 'C', 'H',
+                                             'S', 'N', 'A', 'P'};
+  static const uint32_t current_version = 4;
+  static const uint64_t space_alignment = 4096;
+
+  // flags
+  static const uint32_t FLAG_MERGE_BLOCKS = 1 << 0;
+  static const uint32_t FLAG_SKIP_FIRST_FIELD = 1 << 1;
+  static const uint32_t FLAG_INCREMENTAL = 1 << 2;
+  // root and field values point at the block metadata (the lowest byte of
+  // which is the mutator's header), see MarkAndSweep::merged_header
+  static const uint32_t FLAG_MERGED_HEADER = 1 << 3;
+  // fields are 32-bit references, see MarkAndSweep::compress
+  static const uint32_t FLAG_COMPRESSED_REFS = 1 << 4;
+  static const uint32_t FLAG_IMAGE = 1 << 5;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+
+  uint64_t space_start;
+  uint64_t space_size;
+  uint64_t metadata_size;
+  uint64_t freelist;
+
+  uint64_t n_roots;
+  uint64_t roots_offset;
+  uint64_t n_free_blocks;
+  uint64_t freelist_offset;
+  uint64_t space_offset;
+
+  uint64_t collections;
+  uint64_t incremental_collections;
+
+  // images only: pointers outside of the heap are relocated by the distance
+  // between this address and the one given when loading (0 = none), they
+  // must point into [external_start, external_end)
+  uint64_t external_base;
+  uint64_t external_start;
+  uint64_t external_end;
+};
+
+struct SnapshotRoot {
+  uint64_t address;
+  uint64_t value;
+};
+
+// Block metadata as stored in the heap section.
+struct SnapshotMetadata {
+  // marks
+  static const uint8_t NOT_MARKED = 0;
+  static const uint8_t MARKED = 1;
+  static const uint8_t FREE = 2;
+
+  uint8_t header;
+  uint8_t mark;
+  uint16_t done;
+  uint32_t block_size;
+};
+
+struct SnapshotBlock {
+  uint64_t address;
+  uint32_t block_size;
+  bool free;
+};
+
+// Read-only view of a snapshot (e.g. an mmap'ed file).
+class Snapshot {
+public:
+  struct TypeStats {
+    size_t objects;
+    size_t bytes;
+  };
+
+  struct Summary {
+    size_t n_blocks_used;
+    size_t n_blocks_free;
+    size_t bytes_used;
+    size_t bytes_free;
+    size_t largest_free_block;
+    size_t n_reachable;
+    size_t bytes_reachable;
+  };
+
+  // throws std::runtime_error if data is not a valid snapshot
+  explicit Snapshot(std::span<const unsigned char> data);
+
+  const SnapshotHeader &header() const;
+  std::span<const SnapshotRoot> roots() const;
+  std::span<const uint64_t> freelist() const;
+  std::vector<SnapshotBlock> blocks() const;
+
+  bool is_in_space(uint64_t address) const;
+  const SnapshotMetadata &metadata(uint64_t address) const;
+  // with COMPRESSED_REFS the decompressed value (0 for external references)
+  uint64_t field(uint64_t address, size_t i) const;
+  size_t field_count(uint64_t address) const;
+
+  // addresses of all objects reachable from roots
+  std::vector<uint64_t> reachable() const;
+  Summary summary() const;
+  // live (reachable) objects grouped by the tag in the first word
+  // (stella_object header), only meaningful with SKIP_FIRST_FIELD or
+  // MERGED_HEADER
+  std::map<int, TypeStats> type_stats() const;
+  // all used blocks grouped by block size
+  std::map<size_t, TypeStats> size_stats() const;
+
+private:
+  std::span<const unsigned char> data_;
+  const SnapshotHeader *header_;
+};
+
+} // namespace gc
@@ -1,38 +1,110 @@
 #include "tables.hpp"
 
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
 
 namespace tables {
-void Table::add_row(std::vector<std::string> columns) {
+Table::Table(std::vector<size_t> column_sizes)
+    : column_sizes(column_sizes),
+      buffer(std::make_unique<std::ostringstream>()),
+      out(*buffer) {}
+
+Table::Table(std::vector<size_t> column_sizes, std::ostream &out)
+    : column_sizes(column_sizes), out(out) {}
+
+void Table::add_row(std::initializer_list<std::string_view> columns) {
   assert(columns.size() == column_sizes.size());
-  std::string res;
-  for (size_t i = 0; i < columns.size(); i++) {
-    auto size = column_sizes.at(i);
-    auto str = columns.at(i).substr(0, size);
-    auto pad = std::string(1 + size - str.size(), ' ');
-    res.append("| ");
-    res.append(str + pad);
+  row.clear();
+  auto size = column_sizes.begin();
+  for (auto column : columns) {
+    auto str = column.substr(0, *size);
+    row.append("| ");
+    row.append(str);
+    row.append(1 + *size - str.size(), ' ');
+    size++;
   }
-  res.push_back('|');
-  rows.push_back(res);
+  row.push_back('|');
+  write_row();
 }
 void Table::separator() {
-  std::string res;
+  row.clear();
   for (size_t s : column_sizes) {
-    res.push_back('+');
-    res.append(std::string(2 + s, '-'));
+    row.push_back('+');
+    row.append(2 + s, '-');
+  }
+  row.push_back('+');
+  write_row();
+}
+void Table::write_row() {
+  // rows are separated (not terminated) by newlines
+  if (!first_row) {
+    out.put('\n');
   }
-  res.push_back('+');
-  rows.push_back(res);
+  first_row = false;
+  out.write(row.data(), row.size());
 }
 std::string Table::to_string() const {
-  std::string res;
-  for (size_t i = 0; i < rows.size(); i++) {
-    if (i > 0) {
-      res.append("\n");
+  assert(buffer && "table was written to a stream");
+  return buffer->str();
+}
+
+FileStream::FileStream(std::FILE *file) : std::ostream(&buffer), buffer(file) {}
+
+FileStream::~FileStream() { buffer.pubsync(); }
+
+FileStream::Buffer::Buffer(std::FILE *file) : file(file) {
+  setp(data.data(), data.data() + data.size());
+}
+
+int FileStream::Buffer::sync() {
+  auto n = static_cast<size_t>(pptr() - pbase());
+  if (n > 0 && std::fwrite(pbase(), 1, n, file) != n) {
+    return -1;
+  }
+  setp(data.data(), data.data() + data.size());
+  return std::fflush(file);
+}
+
+FileStream::Buffer::int_type FileStream::Buffer::overflow(int_type c) {
+  if (sync() != 0) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+FdStream::FdStream(int fd) : std::ostream(&buffer), buffer(fd) {}
+
+FdStream::~FdStream() { buffer.pubsync(); }
+
+FdStream::Buffer::Buffer(int fd) : fd(fd) {
+  setp(data.data(), data.data() + data.size());
+}
+
+int FdStream::Buffer::sync() {
+  for (auto p = pbase(); p < pptr();) {
+    auto n = ::write(fd, p, static_cast<size_t>(pptr() - p));
+    if (n < 0 && errno != EINTR) {
+      return -1;
     }
-    res.append(rows.at(i));
+    p += n > 0 ? n : 0;
+  }
+  setp(data.data(), data.data() + data.size());
+  return 0;
+}
+
+FdStream::Buffer::int_type FdStream::Buffer::overflow(int_type c) {
+  if (sync() != 0) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
   }
-  return res;
+  return traits_type::not_eof(c);
 }
-}  // namespace tables
\ No newline at end of file
+}  // namespace tables
@@ -1,17 +1,78 @@
-#include <vector>
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace tables {
 class Table {
  public:
-  Table(std::vector<size_t> column_sizes) : column_sizes(column_sizes) {}
+  // rows are kept in memory until to_string()
+  Table(std::vector<size_t> column_sizes);
+  // rows are written to `out` as soon as they are added
+  Table(std::vector<size_t> column_sizes, std::ostream &out);
 
-  void add_row(std::vector<std::string> columns);
+  void add_row(std::initializer_list<std::string_view> columns);
   void separator();
   std::string to_string() const;
 
  private:
   std::vector<size_t> column_sizes;
-  std::vector<std::string> rows;
+  std::unique_ptr<std::ostringstream> buffer;
+  std::ostream &out;
+  std::string row;
+  bool first_row = true;
+
+  void write_row();
+};
+
+// std::ostream writing to a FILE* through a fixed-size buffer.
+class FileStream : public std::ostream {
+ public:
+  explicit FileStream(std::FILE *file);
+  ~FileStream();
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    explicit Buffer(std::FILE *file);
+    int sync() override;
+    int_type overflow(int_type c) override;
+
+   private:
+    std::FILE *file;
+    std::array<char, 64 * 1024> data;
+  };
+
+  Buffer buffer;
+};
+
+// std::ostream writing to a file descriptor through a fixed-size buffer.
+// Only write(2) is called once the stream is constructed, so it can be used
+// in a child of a multi-threaded process after fork().
+class FdStream : public std::ostream {
+ public:
+  explicit FdStream(int fd);
+  ~FdStream();
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    explicit Buffer(int fd);
+    int sync() override;
+    int_type overflow(int_type c) override;
+
+   private:
+    int fd;
+    std::array<char, 64 * 1024> data;
+  };
+
+  Buffer buffer;
 };
-}  // namespace tables
\ No newline at end of file
+}  // namespace tables
@@ -0,0 +1,84 @@
+#include <catch2/catch_test_macros.hpp>
+#include <alloc_profiler.hpp>
+#include <sstream>
+#include <string>
+
+TEST_CASE("alloc profiler - disabled") {
+  gc::AllocProfiler profiler(0);
+  for (size_t i = 0; i < 1000; i++) {
+    profiler.record(1, 24);
+  }
+  REQUIRE(!profiler.enabled());
+  REQUIRE(profiler.get_samples() == 0);
+  REQUIRE(profiler.get_sites().empty());
+}
+
+TEST_CASE("alloc profiler - sampling rate") {
+  const size_t interval = 1024;
+  const size_t n = 100000;
+  gc::AllocProfiler profiler(interval, 123);
+  for (size_t i = 0; i < n; i++) {
+    profiler.record(1, 24);
+    profiler.record(2, 512);
+  }
+  double bytes[3] = {0, 0, 0};
+  for (auto &[key, site] : profiler.get_sites()) {
+    bytes[key.first] += site.bytes;
+  }
+  // ~ (24 + 512) * n / interval samples
+  REQUIRE(profiler.get_samples() > 40000);
+  REQUIRE(profiler.get_samples() < 60000);
+  REQUIRE(bytes[1] > 0.9 * 24 * n);
+  REQUIRE(bytes[1] < 1.1 * 24 * n);
+  REQUIRE(bytes[2] > 0.9 * 512 * n);
+  REQUIRE(bytes[2] < 1.1 * 512 * n);
+}
+
+TEST_CASE("alloc profiler - collapsed stacks") {
+  gc::AllocProfiler profiler(1);
+  int a, b, c;
+  profiler.record(1, 16, {&a, &b});
+  profiler.record(1, 16, {&a, &b});
+  profiler.record(2, 24, {&c});
+  auto &sites = profiler.get_sites();
+  REQUIRE(sites.size() == 2);
+  REQUIRE(sites.at({1, {&a, &b}}).samples == 2);
+  REQUIRE(sites.at({2, {&c}}).samples == 1);
+  std::ostringstream out;
+  profiler.write_collapsed(out,
+                           [](int tag) { return "TAG" + std::to_string(tag); });
+  auto collapsed = out.str();
+  REQUIRE(collapsed.find(";TAG1 32\n") != std::string::npos);
+  REQUIRE(collapsed.find(";TAG2 24\n") != std::string::npos);
+}
+
+TEST_CASE("alloc profiler - call stacks") {
+  gc::AllocProfiler profiler(1);
+  profiler.record(1, 16);
+  REQUIRE(profiler.get_samples() == 1);
+  auto &[key, site] = *profiler.get_sites().begin();
+  REQUIRE(!key.second.empty());
+  REQUIRE(site.samples == 1);
+}
+
+TEST_CASE("alloc profiler - countdown per thread") {
+  const size_t interval = 1024;
+  const size_t n = 100000;
+  gc::AllocProfiler profiler(interval);
+  gc::AllocProfiler::Countdown first(profiler, 1), second(profiler, 2);
+  int a;
+  for (size_t i = 0; i < n; i++) {
+    if (first.sampled(64)) {
+      profiler.record(1, 64, {&a});
+    }
+    if (second.sampled(64)) {
+      profiler.record(1, 64, {&a});
+    }
+  }
+  // ~ 2 * 64 * n / interval samples
+  REQUIRE(profiler.get_samples() > 11000);
+  REQUIRE(profiler.get_samples() < 14000);
+  auto bytes = profiler.get_sites().at({1, {&a}}).bytes;
+  REQUIRE(bytes > 0.9 * 2 * 64 * n);
+  REQUIRE(bytes < 1.1 * 2 * 64 * n);
+}
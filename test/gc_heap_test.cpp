@@ -0,0 +1,129 @@
+#include <catch2/catch_test_macros.hpp>
+#include <future>
+#include <runtime.h>
+#include <thread>
+#include <unistd.h>
+
+// builds the list [n - 1, ..., 1, 0] of naturals on the current heap
+stella_object *build_list(int n) {
+  stella_object *list = &the_EMPTY;
+  gc_push_root(reinterpret_cast<void **>(&list));
+  for (int i = 0; i < n; i++) {
+    auto head = nat_to_stella_object(i);
+    gc_push_root(reinterpret_cast<void **>(&head));
+    auto cons = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(cons, 0, head);
+    STELLA_OBJECT_INIT_FIELD(cons, 1, list);
+    list = cons;
+    gc_pop_root(reinterpret_cast<void **>(&head));
+  }
+  gc_pop_root(reinterpret_cast<void **>(&list));
+  return list;
+}
+
+int list_sum(stella_object *list) {
+  int sum = 0;
+  while (STELLA_OBJECT_HEADER_TAG(list->object_header) == TAG_CONS) {
+    sum += stella_object_to_nat(
+        static_cast<stella_object *>(STELLA_OBJECT_READ_FIELD(list, 0)));
+    list = static_cast<stella_object *>(STELLA_OBJECT_READ_FIELD(list, 1));
+  }
+  return sum;
+}
+
+TEST_CASE("heap api - create, use, alloc, destroy") {
+  auto heap = gc_heap_create(64 * 1024, 0);
+  REQUIRE(heap != nullptr);
+  auto previous = gc_heap_use(heap);
+  auto list = build_list(20);
+  gc_push_root(reinterpret_cast<void **>(&list));
+  gc_collect();
+  REQUIRE(list_sum(list) == 20 * 19 / 2);
+  REQUIRE(gc_heap_alloc(heap, 16) != nullptr);
+  gc_stats stats;
+  gc_heap_get_stats(heap, &stats);
+  REQUIRE(stats.collections > 0);
+  REQUIRE(stats.heap_bytes == 64 * 1024);
+  gc_pop_root(reinterpret_cast<void **>(&list));
+  REQUIRE(gc_heap_use(previous) == heap);
+  gc_heap_destroy(heap);
+  // the default heap is still there
+  REQUIRE(list_sum(build_list(3)) == 3);
+}
+
+TEST_CASE("heap api - destroyed by another thread") {
+  std::promise<gc_heap *> used;
+  std::promise<void> destroyed;
+  std::thread thread([&] {
+    auto heap = gc_heap_create(64 * 1024, 0);
+    gc_heap_use(heap);
+    build_list(20);
+    used.set_value(heap);
+    destroyed.get_future().wait();
+    // the thread was still running on the destroyed heap
+    auto other = gc_heap_create(64 * 1024, 0);
+    gc_heap_use(other);
+    build_list(20);
+    gc_heap_use(nullptr);
+    gc_heap_destroy(other);
+  });
+  auto heap = used.get_future().get();
+  gc_heap_destroy(heap);
+  destroyed.set_value();
+  thread.join();
+}
+
+TEST_CASE("heap api - threads exit after their heap is destroyed") {
+  auto heap = gc_heap_create(64 * 1024, 0);
+  std::promise<void> used[2];
+  std::promise<void> destroyed;
+  auto destroyed_future = destroyed.get_future().share();
+  std::thread threads[2];
+  for (size_t i = 0; i < 2; i++) {
+    threads[i] = std::thread([&, i] {
+      gc_heap_use(heap);
+      build_list(20);
+      // not running on it anymore
+      gc_heap_use(nullptr);
+      used[i].set_value();
+      destroyed_future.wait();
+    });
+  }
+  for (auto &promise : used) {
+    promise.get_future().wait();
+  }
+  gc_heap_destroy(heap);
+  destroyed.set_value();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+TEST_CASE("heap api - image replaced while loaded") {
+  char path[] = "/tmp/lich-image-XXXXXX";
+  close(mkstemp(path));
+  auto writer = gc_heap_create(4 * 1024 * 1024, 0);
+  auto previous = gc_heap_use(writer);
+  void *roots[1] = {build_list(200)};
+  REQUIRE(gc_heap_write_image(writer, path, roots, 1) == 0);
+  gc_heap_use(previous);
+  gc_heap_destroy(writer);
+
+  // pages of the image are only read when touched
+  auto reader = gc_heap_create(4 * 1024 * 1024, 0);
+  REQUIRE(gc_heap_load_image(reader, path, roots, 1) == 0);
+  auto list = static_cast<stella_object *>(roots[0]);
+
+  writer = gc_heap_create(4 * 1024 * 1024, 0);
+  gc_heap_use(writer);
+  void *other[1] = {build_list(10)};
+  REQUIRE(gc_heap_write_image(writer, path, other, 1) == 0);
+  gc_heap_use(previous);
+  gc_heap_destroy(writer);
+
+  gc_heap_use(reader);
+  REQUIRE(list_sum(list) == 200 * 199 / 2);
+  gc_heap_use(previous);
+  gc_heap_destroy(reader);
+  unlink(path);
+}
@@ -0,0 +1,49 @@
+#include <catch2/catch_test_macros.hpp>
+#include <heap_sizing.hpp>
+
+TEST_CASE("heap sizing - trigger") {
+  gc::HeapSizing sizing(1024, 64 * 1024);
+  REQUIRE(sizing.limit() == 1024);
+  REQUIRE(sizing.trigger() == 768);
+  REQUIRE(!sizing.should_collect(767));
+  REQUIRE(sizing.should_collect(768));
+}
+
+TEST_CASE("heap sizing - grows with survival") {
+  gc::HeapSizing sizing(1024, 64 * 1024);
+  sizing.collected(700, 0, 1000);
+  REQUIRE(sizing.limit() == 2048);
+  // live data alone reaches the trigger
+  sizing.collected(4000, 0, 1000);
+  REQUIRE(sizing.limit() == 8192);
+  REQUIRE(sizing.trigger() > 4000);
+  // bounded by the maximum
+  sizing.collected(60 * 1024, 0, 1000);
+  REQUIRE(sizing.limit() == 64 * 1024);
+  REQUIRE(sizing.trigger() > 60 * 1024);
+  REQUIRE(sizing.trigger() <= 64 * 1024);
+}
+
+TEST_CASE("heap sizing - grows with GC time") {
+  gc::HeapSizing sizing(1024, 64 * 1024);
+  // 20% of the time in GC, little survives
+  sizing.collected(200, 200, 1000);
+  REQUIRE(sizing.limit() == 2048);
+  // 1%
+  sizing.collected(400, 10, 1000);
+  REQUIRE(sizing.limit() == 2048);
+}
+
+TEST_CASE("heap sizing - shrinks") {
+  gc::HeapSizing sizing(1024, 64 * 1024);
+  for (int i = 0; i < 4; i++) {
+    sizing.collected(60 * 1024, 0, 1000);
+  }
+  REQUIRE(sizing.limit() == 64 * 1024);
+  sizing.collected(1024, 0, 1000);
+  REQUIRE(sizing.limit() == 32 * 1024);
+  for (int i = 0; i < 10; i++) {
+    sizing.collected(0, 0, 1000);
+  }
+  REQUIRE(sizing.limit() == 1024);
+}
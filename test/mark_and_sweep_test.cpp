@@ -7,6 +7,7 @@
 #include <queue>
 #include <random>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,17 @@ struct B {
   B *z = nullptr;
 };
 
+// objects freed by the last sweep
+struct CollectedObjects : gc::SweepObserver {
+  std::vector<void *> objects;
+
+  void sweep_started() override { objects.clear(); }
+  void collected(void *obj) override { objects.push_back(obj); }
+  bool contains(void *obj) const {
+    return std::find(objects.begin(), objects.end(), obj) != objects.end();
+  }
+};
+
 TEST_CASE("no objects") {
   gc::MarkAndSweep collector(32, false, false, false);
   auto stats = collector.get_stats();
@@ -125,9 +137,171 @@ TEST_CASE("collect - one alive object") {
   REQUIRE(stats.bytes_used + stats.bytes_free == size);
 }
 
+TEST_CASE("pause stats") {
+  gc::MarkAndSweep collector(256, true, false, false);
+  gc::Stats stats;
+  void *obj = collector.allocate(8);
+  collector.push_root(&obj);
+  collector.collect();
+  collector.collect();
+  stats = collector.get_stats();
+  REQUIRE(stats.full_pauses.count == 2);
+  REQUIRE(stats.incremental_pauses.count == 0);
+  REQUIRE(stats.full_pauses.max_ns >= stats.full_pauses.percentile(0.5));
+  REQUIRE(stats.full_pauses.total_ns >=
+          stats.mark_ns + stats.sweep_ns + stats.decommit_ns);
+  for (auto mmu : stats.mmu) {
+    REQUIRE(mmu <= 1.0);
+  }
+}
+
+TEST_CASE("pause stats (incremental)") {
+  gc::MarkAndSweep collector(256, true, true, true);
+  gc::Stats stats;
+  for (size_t i = 0; i < 100; i++) {
+    REQUIRE(collector.allocate(8) != nullptr);
+  }
+  stats = collector.get_stats();
+  REQUIRE(stats.full_pauses.count == 0);
+  REQUIRE(stats.incremental_pauses.count == 100);
+  REQUIRE(stats.incremental_collections > 0);
+}
+
+TEST_CASE("incremental - roots updated without barrier") {
+  struct Cell {
+    size_t header;
+    Cell *next;
+  };
+  const size_t max_length = 10;
+  gc::MarkAndSweep collector(1024, true, true, true);
+  Cell *list = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&list));
+  for (size_t i = 0; i < 1000; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    REQUIRE(cell != nullptr);
+    cell->header = 0;
+    cell->next = list;
+    list = cell;
+    size_t length = 0;
+    for (auto p = list; p; p = p->next) {
+      collector.read(p);
+      if (++length == max_length) {
+        p->next = nullptr;
+      }
+    }
+    REQUIRE(length == std::min(i + 1, max_length));
+  }
+  REQUIRE(collector.get_stats().incremental_collections > 0);
+}
+
+TEST_CASE("incremental - first field is skipped") {
+  struct Cell {
+    size_t header;
+    Cell *next;
+  };
+  gc::MarkAndSweep collector(1024, true, true, true);
+  CollectedObjects collected_objects;
+  collector.set_sweep_observer(&collected_objects);
+  auto garbage = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+  auto live = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+  REQUIRE(garbage != nullptr);
+  REQUIRE(live != nullptr);
+  // header looks like a pointer, but must not be followed
+  live->header = reinterpret_cast<size_t>(garbage);
+  live->next = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&live));
+  // garbage is freed by the current cycle or by the next one
+  auto cycles = collector.get_stats().incremental_collections;
+  bool collected = false;
+  while (collector.get_stats().incremental_collections < cycles + 2) {
+    REQUIRE(collector.allocate(sizeof(Cell)) != nullptr);
+    collected = collected || collected_objects.contains(garbage);
+    REQUIRE(!collected_objects.contains(live));
+  }
+  REQUIRE(collected);
+}
+
+TEST_CASE("incremental - finish cycle when out of memory") {
+  gc::MarkAndSweep collector(1024, true, true, true);
+  // as in SharedHeap, phase changes wait until the world is stopped
+  collector.defer_phase_changes(true);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  auto live = reinterpret_cast<A *>(collector.allocate(sizeof(A)));
+  REQUIRE(live != nullptr);
+  live->x = nullptr;
+  live->y = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&live));
+  while (collector.allocate(sizeof(A)) != nullptr) {
+  }
+  auto stats = collector.get_stats();
+  REQUIRE(stats.incremental_fallbacks == 0);
+  auto cycles = stats.incremental_collections;
+
+  collector.finish_cycle();
+  stats = collector.get_stats();
+  REQUIRE(stats.incremental_fallbacks == 1);
+  REQUIRE(stats.incremental_collections == cycles + 1);
+  REQUIRE(stats.full_pauses.count == 1);
+  REQUIRE(!collector.phase_change_pending());
+  REQUIRE(!collected.contains(live));
+  REQUIRE(collector.allocate(sizeof(A)) != nullptr);
+
+  // a whole new cycle
+  collector.finish_cycle();
+  stats = collector.get_stats();
+  REQUIRE(stats.incremental_fallbacks == 2);
+  REQUIRE(stats.incremental_collections == cycles + 2);
+  REQUIRE(!collected.contains(live));
+  REQUIRE(stats.n_blocks_used == 1);
+}
+
+TEST_CASE("incremental - collect") {
+  gc::MarkAndSweep collector(1024, true, true, true);
+  auto live = reinterpret_cast<A *>(collector.allocate(sizeof(A)));
+  REQUIRE(live != nullptr);
+  live->x = nullptr;
+  live->y = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&live));
+  // garbage allocated in every phase of the cycle
+  for (size_t i = 0; i < 20; i++) {
+    REQUIRE(collector.allocate(sizeof(A)) != nullptr);
+  }
+  collector.collect();
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 1);
+  REQUIRE(stats.full_pauses.count == 1);
+  REQUIRE(stats.incremental_fallbacks == 0);
+}
+
+TEST_CASE("incremental - step") {
+  gc::MarkAndSweep collector(1024, true, true, true);
+  collector.defer_phase_changes(true);
+  for (size_t i = 0; i < 20; i++) {
+    REQUIRE(collector.allocate(sizeof(A)) != nullptr);
+  }
+  auto never = gc::clock::time_point::max();
+  auto cycles = collector.get_stats().incremental_collections;
+  size_t steps = 0;
+  while (!collector.step(64, never)) {
+    steps++;
+    REQUIRE(collector.get_stats().incremental_collections == cycles);
+  }
+  // the heap is bigger than a step
+  REQUIRE(steps > 0);
+  REQUIRE(!collector.phase_change_pending());
+  auto stats = collector.get_stats();
+  REQUIRE(stats.incremental_collections == cycles + 1);
+  // a whole cycle frees all garbage
+  REQUIRE(collector.step(0, never));
+  REQUIRE(collector.get_stats().n_blocks_used == 0);
+}
+
 TEST_CASE("collect - example 13.4 (A. Appel)") {
   const size_t size = 256;
   gc::MarkAndSweep collector(size, false, false, false);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
   gc::Stats stats;
   std::string dump;
 
@@ -177,7 +351,7 @@ TEST_CASE("collect - example 13.4 (A. Appel)") {
   REQUIRE(a_20 == a_20_copy);
 
   std::set<std::string> collected_objects;
-  for (auto obj : stats.collected_objects) {
+  for (auto obj : collected.objects) {
     if (obj == a_12) {
       collected_objects.insert(NAME_OF(a_12));
     } else if (obj == a_15) {
@@ -206,6 +380,99 @@ TEST_CASE("collect - example 13.4 (A. Appel)") {
   REQUIRE(stats.bytes_used_max == (5 * (8 + 16) + 2 * (8 + 8)));
 }
 
+TEST_CASE("sweep observer - freed objects can still be read") {
+  struct Tags : gc::SweepObserver {
+    size_t sweeps = 0;
+    std::vector<size_t> tags;
+
+    void sweep_started() override { sweeps++; }
+    void collected(void *obj) override {
+      tags.push_back(*static_cast<size_t *>(obj));
+    }
+  };
+  gc::MarkAndSweep collector(256, true, false, false);
+  Tags tags;
+  collector.set_sweep_observer(&tags);
+  for (size_t tag : {1, 2}) {
+    *static_cast<size_t *>(collector.allocate(sizeof(size_t))) = tag;
+  }
+  collector.collect();
+  REQUIRE(tags.sweeps == 1);
+  REQUIRE(tags.tags == std::vector<size_t>{1, 2});
+  // nothing is reported without an observer
+  collector.set_sweep_observer(nullptr);
+  collector.allocate(sizeof(size_t));
+  collector.collect();
+  REQUIRE(tags.sweeps == 1);
+  REQUIRE(tags.tags.size() == 2);
+}
+
+TEST_CASE("mark strategy - pointer reversal, mark stack and overflow") {
+  struct Node {
+    Node *left;
+    Node *right;
+  };
+  for (auto strategy :
+       {gc::MarkStrategy::POINTER_REVERSAL, gc::MarkStrategy::MARK_STACK}) {
+    for (size_t max_stack : {1, 2, 1024}) {
+      gc::MarkAndSweep collector(64 * 1024, true, false, false);
+      collector.set_mark_strategy(strategy, max_stack);
+      CollectedObjects collected;
+      collector.set_sweep_observer(&collected);
+      // a complete tree whose leaves point back to the root
+      std::vector<Node *> nodes;
+      for (size_t i = 0; i < 255; i++) {
+        auto node =
+            reinterpret_cast<Node *>(collector.allocate(sizeof(Node)));
+        REQUIRE(node != nullptr);
+        nodes.push_back(node);
+      }
+      auto expected_left = [&nodes](size_t i) {
+        return 2 * i + 2 >= nodes.size() ? nodes[0] : nodes[2 * i + 1];
+      };
+      auto expected_right = [&nodes](size_t i) {
+        return 2 * i + 2 >= nodes.size() ? nullptr : nodes[2 * i + 2];
+      };
+      for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]->left = expected_left(i);
+        nodes[i]->right = expected_right(i);
+      }
+      auto garbage = collector.allocate(sizeof(Node));
+      auto root = nodes[0];
+      collector.push_root(reinterpret_cast<void **>(&root));
+
+      collector.collect();
+      auto stats = collector.get_stats();
+      REQUIRE(stats.n_blocks_used == nodes.size());
+      REQUIRE(collected.objects == std::vector<void *>{garbage});
+      // fields are intact
+      for (size_t i = 0; i < nodes.size(); i++) {
+        REQUIRE(nodes[i]->left == expected_left(i));
+        REQUIRE(nodes[i]->right == expected_right(i));
+      }
+      collector.pop_root(reinterpret_cast<void **>(&root));
+      collector.collect();
+      REQUIRE(collector.get_stats().n_blocks_used == 0);
+    }
+  }
+}
+
+TEST_CASE("mark strategy - mark stack scans any number of fields") {
+  // more than pointer reversal can count in `done`
+  const size_t n_fields = 70000;
+  gc::MarkAndSweep collector(1024 * 1024, true, false, false);
+  auto wide =
+      static_cast<void **>(collector.allocate(n_fields * sizeof(void *)));
+  REQUIRE(wide != nullptr);
+  auto last = collector.allocate(sizeof(void *));
+  wide[n_fields - 1] = last;
+  collector.push_root(reinterpret_cast<void **>(&wide));
+  collector.collect();
+  REQUIRE(collector.get_stats().n_blocks_used == 2);
+  REQUIRE(wide[n_fields - 1] == last);
+  collector.pop_root(reinterpret_cast<void **>(&wide));
+}
+
 TEST_CASE("allocate / collect - take all memory") {
   const size_t size = 64;
   gc::MarkAndSweep collector(size, false, false, false);
@@ -261,6 +528,41 @@ TEST_CASE("allocate / collect - take all memory") {
   REQUIRE(stats.n_blocks_total == stats.n_blocks_used + stats.n_blocks_free);
 }
 
+TEST_CASE("dump blocks - limited / sampled") {
+  gc::MarkAndSweep collector(1024, false, false, false);
+  for (size_t i = 0; i < 10; i++) {
+    REQUIRE(collector.allocate(8) != nullptr);
+  }
+  auto count = [](const std::string &dump, const std::string &what) {
+    size_t n = 0;
+    for (auto pos = dump.find(what); pos != std::string::npos;
+         pos = dump.find(what, pos + 1)) {
+      n++;
+    }
+    return n;
+  };
+  auto full = collector.dump_blocks();
+  REQUIRE(count(full, "USED |") == 10);
+  REQUIRE(count(full, "FREE |") == 1);
+  REQUIRE(count(full, "OMITTED") == 0);
+
+  std::ostringstream limited;
+  collector.dump_blocks(limited, gc::DumpOptions{.max_rows = 6});
+  REQUIRE(count(limited.str(), "USED |") == 3);
+  REQUIRE(count(limited.str(), "field #1") == 3);
+  REQUIRE(limited.str().find("OMITTED") != std::string::npos);
+  REQUIRE(limited.str().find("8 blocks") != std::string::npos);
+
+  std::ostringstream sampled;
+  collector.dump_blocks(sampled, gc::DumpOptions{.sample_every = 5});
+  REQUIRE(count(sampled.str(), "USED |") == 2);
+  REQUIRE(count(sampled.str(), "FREE |") == 1);
+
+  std::ostringstream streamed;
+  collector.dump(streamed);
+  REQUIRE(streamed.str() == collector.dump());
+}
+
 TEST_CASE("merge blocks") {
   const size_t size = 64;
   gc::MarkAndSweep collector(size, true, false, false);
@@ -304,6 +606,518 @@ TEST_CASE("merge blocks") {
   std::cout << dump << std::endl;
 }
 
+TEST_CASE("merge blocks - dead blocks next to free ones") {
+  const size_t size = 96;
+  gc::MarkAndSweep collector(size, true, false, false);
+  std::vector<void *> objects;
+  for (size_t i = 0; i < 6; i++) {
+    objects.push_back(collector.allocate(8));
+    REQUIRE(objects.back() != nullptr);
+  }
+  // every other block is freed
+  for (size_t i = 1; i < 6; i += 2) {
+    collector.push_root(&objects[i]);
+  }
+  collector.collect();
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 3);
+  REQUIRE(stats.n_blocks_free == 3);
+  // garbage in one of the free blocks
+  REQUIRE(collector.allocate(8) != nullptr);
+
+  // free, dead, dead (new object) and the rest of the heap merge together
+  collector.pop_root(&objects[5]);
+  collector.pop_root(&objects[3]);
+  collector.collect();
+  stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 1);
+  REQUIRE(stats.n_blocks_free == 2);
+  REQUIRE(stats.n_blocks_total == stats.n_blocks_used + stats.n_blocks_free);
+  REQUIRE(stats.bytes_used + stats.bytes_free == size);
+  REQUIRE(collector.allocate(56) != nullptr);
+}
+
+TEST_CASE("buffer - tail given to an object is zeroed") {
+  gc::MarkAndSweep collector(48, false, false, false);
+  // leave stale pointers in the only block
+  auto old = reinterpret_cast<void **>(collector.allocate(40));
+  REQUIRE(old != nullptr);
+  for (size_t i = 0; i < 5; i++) {
+    old[i] = &old[1];
+  }
+  collector.collect();
+
+  gc::MarkAndSweep::Tlab tlab;
+  REQUIRE(collector.refill_tlab(tlab, 48));
+  // the 8 byte tail is too small for a block
+  auto obj = reinterpret_cast<void **>(
+      gc::MarkAndSweep::allocate_in_tlab(tlab, 32));
+  REQUIRE(obj == old);
+  REQUIRE(obj[4] == nullptr);
+  collector.retire_tlab(tlab);
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 1);
+  REQUIRE(stats.bytes_used == 48);
+}
+
+TEST_CASE("conservative roots - only exact pointers to objects") {
+  // three blocks and a buffer fill the heap
+  gc::MarkAndSweep collector(96, true, false, false);
+  collector.enable_conservative_roots();
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  auto a = collector.allocate(16);
+  auto b = collector.allocate(16);
+  auto c = collector.allocate(16);
+  gc::MarkAndSweep::Tlab tlab;
+  REQUIRE(collector.refill_tlab(tlab, 24));
+  auto d = gc::MarkAndSweep::allocate_in_tlab(tlab, 16);
+  collector.retire_tlab(tlab);
+  REQUIRE((a && b && c && d));
+
+  // an aligned pointer into b, garbage and null keep nothing alive
+  std::vector<void *> words = {a, static_cast<char *>(b) + 8,
+                               reinterpret_cast<void *>(0x1234), d, nullptr};
+  collector.scan_conservative_roots({{words.data(), &words.back() + 1}});
+  collector.collect();
+  collector.clear_conservative_roots();
+  REQUIRE(collected.objects.size() == 2);
+  REQUIRE(collected.contains(b));
+  REQUIRE(collected.contains(c));
+
+  // b and c were merged, a new object at b covers c
+  auto e = collector.allocate(40);
+  REQUIRE(e == b);
+  words = {a, c, d};
+  collector.scan_conservative_roots({{words.data(), &words.back() + 1}});
+  collector.collect();
+  collector.clear_conservative_roots();
+  REQUIRE(collected.objects.size() == 1);
+  REQUIRE(collected.contains(e));
+
+  // pointers to free blocks are not objects either
+  words = {a, b, d};
+  collector.scan_conservative_roots({{words.data(), &words.back() + 1}});
+  collector.collect();
+  collector.clear_conservative_roots();
+  REQUIRE(collected.objects.empty());
+  collector.collect();
+  REQUIRE(collected.objects.size() == 2);
+  REQUIRE(collector.get_stats().n_blocks_used == 0);
+}
+
+TEST_CASE("conservative roots - large objects") {
+  gc::MarkAndSweep collector(64 * 1024, true, false, false);
+  collector.set_large_object_threshold(1024);
+  collector.enable_conservative_roots();
+  auto large = collector.allocate(2000);
+  REQUIRE(large != nullptr);
+  void *words[] = {large, static_cast<char *>(large) + 8};
+  collector.scan_conservative_roots({{words, words + 1}});
+  collector.collect();
+  REQUIRE(collector.get_stats().n_large_objects == 1);
+  // interior pointers don't count
+  collector.scan_conservative_roots({{words + 1, words + 2}});
+  collector.collect();
+  collector.clear_conservative_roots();
+  REQUIRE(collector.get_stats().n_large_objects == 0);
+}
+
+TEST_CASE("census - live objects by kind and size") {
+  gc::MarkAndSweep collector(1024, true, true, false);
+  collector.set_census(true, 3, 2);
+  REQUIRE(collector.census().collection == 0);
+  std::vector<void *> roots;
+  // kinds 0, 1, 2 and 6 (2 after masking) with 1 to 4 words after the first
+  for (size_t i = 0; i < 8; i++) {
+    auto obj = static_cast<size_t *>(collector.allocate(8 * (1 + i % 4)));
+    REQUIRE(obj != nullptr);
+    obj[0] = i % 4 == 3 ? 6 : i % 4;
+    if (i < 4) {
+      roots.push_back(obj);
+    }
+  }
+  for (auto &root : roots) {
+    collector.push_root(&root);
+  }
+  collector.collect();
+  auto census = collector.census();
+  REQUIRE(census.collection == 1);
+  REQUIRE(census.by_kind.size() == 4);
+  REQUIRE(census.by_kind[3].objects == 0);
+  REQUIRE(census.by_kind[0].objects == 1);
+  REQUIRE(census.by_kind[0].bytes == 16);
+  REQUIRE(census.by_kind[1].objects == 1);
+  REQUIRE(census.by_kind[1].bytes == 24);
+  REQUIRE(census.by_kind[2].objects == 2);
+  REQUIRE(census.by_kind[2].bytes == 32 + 40);
+  REQUIRE(census.by_size[2].objects == 1);
+  REQUIRE(census.by_size[5].objects == 1);
+  REQUIRE(collector.census_history().empty());
+
+  collector.pop_root(&roots[3]);
+  collector.collect();
+  census = collector.census();
+  REQUIRE(census.collection == 2);
+  REQUIRE(census.by_kind[2].objects == 1);
+  REQUIRE(census.by_size[5].objects == 0);
+  REQUIRE(collector.census_history().size() == 1);
+  REQUIRE(collector.census_history()[0].collection == 2);
+
+  std::ostringstream out;
+  collector.dump_census_history(
+      out, [](size_t kind) { return "K" + std::to_string(kind); });
+  REQUIRE(out.str() == "collection,kind,objects,bytes\n"
+                       "2,K0,1,16\n2,K1,1,24\n2,K2,1,32\n");
+}
+
+TEST_CASE("census - incremental") {
+  gc::MarkAndSweep collector(1024, true, true, true);
+  collector.set_census(true, 1);
+  auto obj = static_cast<size_t *>(collector.allocate(8));
+  REQUIRE(obj != nullptr);
+  obj[0] = 1;
+  collector.push_root(reinterpret_cast<void **>(&obj));
+  REQUIRE(collector.allocate(8) != nullptr);
+  collector.collect();
+  auto census = collector.census();
+  REQUIRE(census.collection > 0);
+  REQUIRE(census.by_kind[0].objects == 0);
+  REQUIRE(census.by_kind[1].objects == 1);
+  REQUIRE(census.by_kind[1].bytes == 16);
+}
+
+TEST_CASE("decommit free blocks") {
+  const size_t size = 1024 * 1024;
+  gc::MarkAndSweep collector(size, true, false, false);
+  collector.set_decommit(64 * 1024);
+  auto obj = reinterpret_cast<size_t *>(collector.allocate(16));
+  obj[0] = 42;
+  obj[1] = 0;
+  collector.push_root(reinterpret_cast<void **>(&obj));
+  for (size_t i = 0; i < 1000; i++) {
+    REQUIRE(collector.allocate(1000) != nullptr);
+  }
+  collector.collect();
+  auto stats = collector.get_stats();
+  // all but the pages around the block's metadata
+  REQUIRE(stats.bytes_decommitted >= size - 3 * 4096);
+  REQUIRE(stats.bytes_decommitted < size);
+  REQUIRE(obj[0] == 42);
+
+  // nothing new to return
+  collector.collect();
+  REQUIRE(collector.get_stats().bytes_decommitted == stats.bytes_decommitted);
+
+  // pages are committed again on allocation
+  auto big = reinterpret_cast<size_t *>(collector.allocate(512 * 1024));
+  REQUIRE(big != nullptr);
+  for (size_t i = 0; i < 512 * 1024 / sizeof(size_t); i++) {
+    big[i] = i;
+  }
+  REQUIRE(big[1000] == 1000);
+  auto decommitted = collector.get_stats().bytes_decommitted;
+  REQUIRE(decommitted <= stats.bytes_decommitted - 512 * 1024);
+  REQUIRE(decommitted >= stats.bytes_decommitted - 512 * 1024 - 2 * 4096);
+
+  // merged blocks aren't counted twice
+  for (size_t i = 0; i < 20; i++) {
+    collector.collect();
+    for (size_t j = 0; j < 100; j++) {
+      REQUIRE(collector.allocate(1000 + i * 100) != nullptr);
+    }
+  }
+  collector.collect();
+  REQUIRE(collector.get_stats().bytes_decommitted < size);
+  REQUIRE(collector.get_stats().bytes_decommitted >= size - 3 * 4096);
+  collector.pop_root(reinterpret_cast<void **>(&obj));
+}
+
+TEST_CASE("huge heap - several first blocks") {
+  // only reserved, so this is cheap
+  const size_t size = static_cast<size_t>(16) << 30;
+  gc::MarkAndSweep collector(size, true, false, false);
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_free == 5);
+  REQUIRE(stats.n_blocks_total == 5);
+  REQUIRE(stats.bytes_free == size);
+
+  void *obj = collector.allocate(4096);
+  REQUIRE(obj != nullptr);
+  collector.push_root(&obj);
+  REQUIRE(collector.allocate(static_cast<size_t>(4) << 30) == nullptr);
+  REQUIRE(collector.allocate(1000) != nullptr);
+  collector.collect();
+  stats = collector.get_stats();
+  // merged blocks stay below the largest block size
+  REQUIRE(stats.n_blocks_used == 1);
+  REQUIRE(stats.n_blocks_free == 5);
+  REQUIRE(stats.bytes_used + stats.bytes_free == size);
+  REQUIRE(stats.n_blocks_total == stats.n_blocks_used + stats.n_blocks_free);
+  collector.pop_root(&obj);
+}
+
+TEST_CASE("huge pages - aligned heap or fallback") {
+  for (auto requested : {gc::HugePages::TRANSPARENT, gc::HugePages::EXPLICIT}) {
+    const size_t size = 3 * 1024 * 1024;
+    gc::MarkAndSweep collector(size, true, true, false, requested);
+    auto backing = collector.huge_pages();
+    if (requested == gc::HugePages::TRANSPARENT) {
+      REQUIRE(backing != gc::HugePages::EXPLICIT);
+    }
+    void *obj = collector.allocate(16);
+    REQUIRE(obj != nullptr);
+    // the first object is right after the metadata at the start of the heap
+    auto start = reinterpret_cast<uintptr_t>(obj) - sizeof(void *);
+    if (backing != gc::HugePages::NONE) {
+      REQUIRE(start % gc::MarkAndSweep::huge_page_size == 0);
+    }
+    collector.push_root(&obj);
+    REQUIRE(collector.allocate(size / 2) != nullptr);
+    collector.collect();
+    auto stats = collector.get_stats();
+    REQUIRE(stats.n_blocks_used == 1);
+    REQUIRE(stats.bytes_used + stats.bytes_free == size);
+    collector.pop_root(&obj);
+  }
+}
+
+TEST_CASE("large objects - own mappings, marked in place") {
+  const size_t size = 4 * 1024 * 1024;
+  gc::MarkAndSweep collector(size, true, false, false);
+  collector.set_large_object_threshold(4096);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  void *small = collector.allocate(16);
+  REQUIRE(small != nullptr);
+  collector.push_root(&small);
+  // more fields than the pointer-reversal marker can count
+  auto large = reinterpret_cast<void **>(collector.allocate(1024 * 1024));
+  REQUIRE(large != nullptr);
+  REQUIRE(large[1024] == nullptr);
+  auto child = collector.allocate(16);
+  large[1024] = child;
+  *reinterpret_cast<void **>(small) = large;
+  auto garbage = collector.allocate(4096);
+  REQUIRE(garbage != nullptr);
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_large_objects == 2);
+  REQUIRE(stats.bytes_large_objects >= 1024 * 1024 + 4096);
+  REQUIRE(stats.n_blocks_used == 2);
+  REQUIRE(stats.bytes_used + stats.bytes_free == size);
+  REQUIRE(collector.bytes_used() ==
+          stats.bytes_used + stats.bytes_large_objects);
+  // blocks and large objects share max_memory
+  REQUIRE(collector.allocate(size) == nullptr);
+
+  collector.collect();
+  stats = collector.get_stats();
+  REQUIRE(collected.objects == std::vector<void *>{garbage});
+  REQUIRE(stats.n_large_objects == 1);
+  REQUIRE(stats.n_blocks_used == 2);
+  REQUIRE(large[1024] == child);
+
+  collector.pop_root(&small);
+  collector.collect();
+  stats = collector.get_stats();
+  REQUIRE(stats.n_large_objects == 0);
+  REQUIRE(stats.bytes_large_objects == 0);
+  REQUIRE(stats.n_blocks_used == 0);
+}
+
+TEST_CASE("large objects - incremental") {
+  const size_t size = 64 * 1024;
+  gc::MarkAndSweep collector(size, true, true, true);
+  collector.set_large_object_threshold(1024);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  auto live = reinterpret_cast<void **>(collector.allocate(2048));
+  REQUIRE(live != nullptr);
+  collector.push_root(reinterpret_cast<void **>(&live));
+  auto cycles = collector.get_stats().incremental_collections;
+  size_t n = 0;
+  while (collector.get_stats().incremental_collections < cycles + 3) {
+    // small objects referenced only from the large one
+    auto obj = reinterpret_cast<void **>(collector.allocate(16));
+    REQUIRE(obj != nullptr);
+    collector.write(live, obj);
+    live[1 + n++ % 255] = obj;
+    REQUIRE(collector.allocate(1024) != nullptr);
+  }
+  for (size_t i = 1; i < 256; i++) {
+    collector.read(live[i]);
+  }
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_large_objects < 5);
+  REQUIRE(!collected.contains(live));
+  for (size_t i = 1; i < 256; i++) {
+    REQUIRE(!collected.contains(live[i]));
+  }
+  collector.pop_root(reinterpret_cast<void **>(&live));
+}
+
+TEST_CASE("merged header - metadata is the object's first word") {
+  struct Succ {
+    int header;
+    Succ *arg;
+  };
+  const size_t size = 256;
+  gc::MarkAndSweep collector(size, true, false, false, gc::HugePages::NONE,
+                             true);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  Succ *n = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&n));
+  std::vector<Succ *> objects;
+  for (size_t i = 0; i < 3; i++) {
+    auto succ = reinterpret_cast<Succ *>(collector.allocate(sizeof(Succ)));
+    REQUIRE(succ != nullptr);
+    // the way Stella initializes a header: other bits are kept
+    succ->header = (succ->header & ~0xff) | 1 | (1 << 4);
+    succ->arg = n;
+    n = succ;
+    objects.push_back(succ);
+  }
+  auto garbage = collector.allocate(sizeof(Succ));
+  auto stats = collector.get_stats();
+  // one word saved per object
+  REQUIRE(stats.bytes_used == 4 * sizeof(Succ));
+  REQUIRE(collector.allocate(8) != nullptr);
+  REQUIRE(collector.get_stats().bytes_used == 4 * sizeof(Succ) + 16);
+
+  collector.collect();
+  stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 3);
+  REQUIRE(collected.contains(garbage));
+  // fields and headers survive marking
+  auto succ = n;
+  for (size_t i = 3; i > 0; i--) {
+    REQUIRE(succ == objects[i - 1]);
+    REQUIRE((succ->header & 0xff) == (1 | (1 << 4)));
+    succ = succ->arg;
+  }
+  REQUIRE(succ == nullptr);
+  collector.pop_root(reinterpret_cast<void **>(&n));
+}
+
+TEST_CASE("merged header - incremental") {
+  struct Cell {
+    size_t header;
+    Cell *next;
+  };
+  const size_t max_length = 10;
+  gc::MarkAndSweep collector(1024, true, false, true, gc::HugePages::NONE,
+                             true);
+  Cell *list = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&list));
+  for (size_t i = 0; i < 1000; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    REQUIRE(cell != nullptr);
+    collector.write(cell, list);
+    cell->next = list;
+    list = cell;
+    size_t length = 0;
+    for (auto p = list; p; p = p->next) {
+      collector.read(p);
+      if (++length == max_length) {
+        p->next = nullptr;
+      }
+    }
+    REQUIRE(length == std::min(i + 1, max_length));
+  }
+  REQUIRE(collector.get_stats().incremental_collections > 0);
+}
+
+TEST_CASE("compressed refs - 32-bit fields") {
+  using ref_t = gc::MarkAndSweep::ref_t;
+  struct Cons {
+    size_t header;
+    ref_t head;
+    ref_t tail;
+  };
+  struct Succ {
+    size_t header;
+    ref_t arg;
+  };
+  gc::MarkAndSweep collector(1024, true, false, false, gc::HugePages::NONE,
+                             true, true);
+  CollectedObjects collected;
+  collector.set_sweep_observer(&collected);
+  REQUIRE(collector.compress(nullptr) == 0);
+  REQUIRE(collector.decompress(0) == nullptr);
+
+  Cons *list = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&list));
+  std::vector<Cons *> cells;
+  for (size_t i = 0; i < 3; i++) {
+    auto succ = reinterpret_cast<Succ *>(collector.allocate(sizeof(Succ)));
+    REQUIRE(succ != nullptr);
+    // the unused half of the last word is zeroed
+    REQUIRE(reinterpret_cast<ref_t *>(&succ->arg)[1] == 0);
+    auto cell = reinterpret_cast<Cons *>(collector.allocate(sizeof(Cons)));
+    REQUIRE(cell != nullptr);
+    cell->head = collector.compress(succ);
+    cell->tail = collector.compress(list);
+    REQUIRE(collector.decompress(cell->head) == succ);
+    list = cell;
+    cells.push_back(cell);
+  }
+  // a word saved per cell
+  REQUIRE(collector.get_stats().bytes_used == 3 * (16 + 16));
+  // external references are not traced
+  auto garbage = collector.allocate(sizeof(Succ));
+  cells.front()->head =
+      collector.compress(garbage) | gc::MarkAndSweep::external_ref_bit;
+  REQUIRE(collector.decompress(cells.front()->head) == nullptr);
+
+  collector.collect();
+  auto stats = collector.get_stats();
+  REQUIRE(stats.n_blocks_used == 5);
+  REQUIRE(collected.contains(garbage));
+  // references are restored after pointer reversal
+  auto cell = list;
+  for (size_t i = 3; i > 0; i--) {
+    REQUIRE(cell == cells[i - 1]);
+    cell = static_cast<Cons *>(collector.decompress(cell->tail));
+  }
+  REQUIRE(cell == nullptr);
+  collector.pop_root(reinterpret_cast<void **>(&list));
+  collector.collect();
+  REQUIRE(collector.get_stats().n_blocks_used == 0);
+}
+
+TEST_CASE("compressed refs - incremental") {
+  using ref_t = gc::MarkAndSweep::ref_t;
+  struct Cell {
+    size_t header;
+    ref_t next;
+  };
+  const size_t max_length = 10;
+  gc::MarkAndSweep collector(1024, true, false, true, gc::HugePages::NONE,
+                             true, true);
+  Cell *list = nullptr;
+  collector.push_root(reinterpret_cast<void **>(&list));
+  auto next = [&collector](Cell *cell) {
+    return static_cast<Cell *>(collector.decompress(cell->next));
+  };
+  for (size_t i = 0; i < 1000; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    REQUIRE(cell != nullptr);
+    collector.write(cell, list);
+    cell->next = collector.compress(list);
+    list = cell;
+    size_t length = 0;
+    for (auto p = list; p; p = next(p)) {
+      collector.read(p);
+      if (++length == max_length) {
+        p->next = 0;
+      }
+    }
+    REQUIRE(length == std::min(i + 1, max_length));
+  }
+  REQUIRE(collector.get_stats().incremental_collections > 0);
+}
+
 template <typename T>
 std::ostream &operator<<(std::ostream &out, const std::set<T> &set) {
   if (set.empty())
@@ -0,0 +1,52 @@
+#include <catch2/catch_test_macros.hpp>
+#include <pauses.hpp>
+
+using namespace std::chrono_literals;
+
+TEST_CASE("pause histogram") {
+  gc::PauseHistogram histogram;
+  REQUIRE(histogram.percentile(0.5) == 0);
+  for (uint64_t ns = 1; ns <= 100; ns++) {
+    histogram.record(ns * 1000);
+  }
+  REQUIRE(histogram.count == 100);
+  REQUIRE(histogram.max_ns == 100'000);
+  REQUIRE(histogram.total_ns == 5050 * 1000);
+  auto p50 = histogram.percentile(0.5);
+  REQUIRE(p50 >= 50'000);
+  REQUIRE(p50 <= 50'000 * 5 / 4);
+  auto p99 = histogram.percentile(0.99);
+  REQUIRE(p99 >= 99'000);
+  REQUIRE(p99 <= 100'000);
+  REQUIRE(histogram.percentile(1.0) == 100'000);
+}
+
+TEST_CASE("minimum mutator utilization") {
+  gc::MutatorUtilization mmu;
+  auto t = gc::clock::now() + 1s;
+  // 2 ms pause, then 1 ms pauses every 10 ms
+  mmu.record(t, t + 2ms);
+  for (int i = 1; i <= 100; i++) {
+    mmu.record(t + i * 10ms, t + i * 10ms + 1ms);
+  }
+  auto utilization = mmu.get();
+  REQUIRE(utilization[0] == 0.0);
+  REQUIRE(utilization[1] >= 0.8 - 1e-9);
+  REQUIRE(utilization[1] <= 0.8 + 1e-9);
+  REQUIRE(utilization[2] >= 0.89 - 1e-9);
+  REQUIRE(utilization[2] <= 0.89 + 1e-9);
+}
+
+TEST_CASE("minimum mutator utilization - frequent short pauses") {
+  gc::MutatorUtilization mmu;
+  auto t = gc::clock::now() + 1s;
+  // 1 us pauses every 4 us for 2 s, merged into much fewer entries
+  for (int i = 0; i < 500'000; i++) {
+    mmu.record(t + i * 4us, t + i * 4us + 1us);
+  }
+  auto utilization = mmu.get();
+  for (auto util : utilization) {
+    REQUIRE(util >= 0.75 - 0.02);
+    REQUIRE(util <= 0.75 + 1e-9);
+  }
+}
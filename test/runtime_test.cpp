@@ -0,0 +1,101 @@
+#include <catch2/catch_test_macros.hpp>
+#include <runtime.h>
+#include <stdio.h>
+#include <string>
+
+// what fprint_stella_object writes, through a temporary file
+std::string print_to_string(stella_object *obj) {
+  auto file = tmpfile();
+  REQUIRE(file != nullptr);
+  fprint_stella_object(file, obj);
+  std::string text(static_cast<size_t>(ftell(file)), '\0');
+  rewind(file);
+  REQUIRE(fread(text.data(), 1, text.size(), file) == text.size());
+  fclose(file);
+  return text;
+}
+
+// each test case runs on a fresh heap
+struct TestHeap {
+  gc_heap *heap = gc_heap_create(64 * 1024 * 1024, 0);
+  gc_heap *previous = gc_heap_use(heap);
+
+  ~TestHeap() {
+    gc_heap_use(previous);
+    gc_heap_destroy(heap);
+  }
+};
+
+stella_object *wrap(enum TAG tag, stella_object *obj) {
+  gc_push_root(reinterpret_cast<void **>(&obj));
+  auto wrapper = alloc_stella_object(tag, 1);
+  STELLA_OBJECT_INIT_FIELD(wrapper, 0, obj);
+  gc_pop_root(reinterpret_cast<void **>(&obj));
+  return wrapper;
+}
+
+TEST_CASE("print - nats") {
+  TestHeap heap;
+  REQUIRE(print_to_string(&the_ZERO) == "0");
+  REQUIRE(print_to_string(nat_to_stella_object(1)) == "1");
+  REQUIRE(print_to_string(nat_to_stella_object(100000)) == "100000");
+}
+
+TEST_CASE("print - deep inl / inr nesting") {
+  TestHeap heap;
+  const size_t depth = 100000;
+  stella_object *obj = &the_UNIT;
+  gc_push_root(reinterpret_cast<void **>(&obj));
+  for (size_t i = 0; i < depth; i++) {
+    obj = wrap(i % 2 ? TAG_INR : TAG_INL, obj);
+  }
+  std::string expected;
+  for (size_t i = depth; i-- > 0;) {
+    expected += i % 2 ? "inr(" : "inl(";
+  }
+  expected += "unit" + std::string(depth, ')');
+  REQUIRE(print_to_string(obj) == expected);
+  gc_pop_root(reinterpret_cast<void **>(&obj));
+}
+
+TEST_CASE("print - long lists") {
+  TestHeap heap;
+  const int length = 100000;
+  stella_object *list = &the_EMPTY;
+  gc_push_root(reinterpret_cast<void **>(&list));
+  REQUIRE(print_to_string(list) == "[]");
+  for (int i = length; i-- > 0;) {
+    auto head = nat_to_stella_object(i % 10);
+    gc_push_root(reinterpret_cast<void **>(&head));
+    auto cons = alloc_stella_object(TAG_CONS, 2);
+    STELLA_OBJECT_INIT_FIELD(cons, 0, head);
+    STELLA_OBJECT_INIT_FIELD(cons, 1, list);
+    list = cons;
+    gc_pop_root(reinterpret_cast<void **>(&head));
+  }
+  std::string expected = "[";
+  for (int i = 0; i < length; i++) {
+    expected += (i > 0 ? ", " : "") + std::to_string(i % 10);
+  }
+  expected += "]";
+  REQUIRE(print_to_string(list) == expected);
+  gc_pop_root(reinterpret_cast<void **>(&list));
+}
+
+TEST_CASE("print - tuples") {
+  TestHeap heap;
+  REQUIRE(print_to_string(&the_EMPTY_TUPLE) == "{}");
+  auto inner = alloc_stella_object(TAG_TUPLE, 2);
+  STELLA_OBJECT_INIT_FIELD(inner, 0, &the_TRUE);
+  STELLA_OBJECT_INIT_FIELD(inner, 1, &the_EMPTY);
+  gc_push_root(reinterpret_cast<void **>(&inner));
+  auto two = nat_to_stella_object(2);
+  gc_push_root(reinterpret_cast<void **>(&two));
+  auto tuple = alloc_stella_object(TAG_TUPLE, 3);
+  STELLA_OBJECT_INIT_FIELD(tuple, 0, two);
+  STELLA_OBJECT_INIT_FIELD(tuple, 1, inner);
+  STELLA_OBJECT_INIT_FIELD(tuple, 2, &the_FALSE);
+  REQUIRE(print_to_string(tuple) == "{2, {true, []}, false}");
+  gc_pop_root(reinterpret_cast<void **>(&two));
+  gc_pop_root(reinterpret_cast<void **>(&inner));
+}
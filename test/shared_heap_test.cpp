@@ -0,0 +1,312 @@
+#include <atomic>
+#include <catch2/catch_test_macros.hpp>
+#include <shared_heap.hpp>
+#include <thread>
+#include <vector>
+
+struct Cell {
+  size_t header;
+  Cell *next;
+};
+
+// Builds lists of `length` cells over and over, counting cells that don't
+// hold what was written (Catch2 assertions can't be used in threads). Without
+// `push_roots` the lists are only found by conservative stack scanning.
+void build_lists(gc::SharedHeap &heap, size_t id, size_t rounds,
+                 std::atomic<size_t> &errors, bool push_roots = true) {
+  const size_t length = 10;
+  gc::SharedHeap::Mutator mutator(heap);
+  Cell *list = nullptr;
+  if (push_roots) {
+    mutator.push_root(reinterpret_cast<void **>(&list));
+  }
+  for (size_t round = 0; round < rounds; round++) {
+    list = nullptr;
+    for (size_t i = 0; i < length; i++) {
+      auto cell = reinterpret_cast<Cell *>(mutator.allocate(sizeof(Cell)));
+      if (!cell) {
+        cell = reinterpret_cast<Cell *>(
+            mutator.collect_and_allocate(sizeof(Cell)));
+      }
+      if (!cell) {
+        errors++;
+        break;
+      }
+      cell->header = id * length + i;
+      cell->next = list;
+      list = cell;
+    }
+    size_t i = length;
+    for (auto p = list; p; p = p->next) {
+      mutator.read(p);
+      if (p->header != id * length + --i) {
+        errors++;
+      }
+    }
+  }
+  if (push_roots) {
+    mutator.pop_root(reinterpret_cast<void **>(&list));
+  }
+}
+
+void run_threads(gc::SharedHeap &heap, size_t n_threads, size_t rounds,
+                 bool push_roots = true) {
+  std::atomic<size_t> errors = 0;
+  std::vector<std::thread> threads;
+  for (size_t id = 0; id < n_threads; id++) {
+    threads.emplace_back(build_lists, std::ref(heap), id, rounds,
+                         std::ref(errors), push_roots);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(errors == 0);
+}
+
+// `self` is the mutator of the calling thread, if it has one
+gc::Stats get_stats(gc::SharedHeap &heap,
+                    gc::SharedHeap::Mutator *self = nullptr) {
+  gc::Stats stats;
+  heap.stop_the_world(self, [&](gc::MarkAndSweep &collector) {
+    stats = collector.get_stats();
+  });
+  return stats;
+}
+
+TEST_CASE("shared heap - threads allocate") {
+  gc::SharedHeap heap(16 * 1024, true, true, false, 512);
+  run_threads(heap, 4, 200);
+  auto stats = get_stats(heap);
+  REQUIRE(stats.collections > 0);
+  REQUIRE(stats.reads == 4 * 200 * 10);
+  REQUIRE(stats.bytes_used + stats.bytes_free == 16 * 1024);
+  REQUIRE(stats.n_blocks_used + stats.n_blocks_free == stats.n_blocks_total);
+}
+
+TEST_CASE("shared heap - threads allocate (incremental)") {
+  gc::SharedHeap heap(16 * 1024, true, true, true, 512);
+  run_threads(heap, 4, 200);
+  auto stats = get_stats(heap);
+  REQUIRE(stats.incremental_collections > 0);
+  REQUIRE(stats.reads == 4 * 200 * 10);
+}
+
+TEST_CASE("shared heap - buffer accounting") {
+  gc::SharedHeap heap(4096, false, true, false, 256);
+  gc::SharedHeap::Mutator mutator(heap);
+  for (size_t i = 0; i < 10; i++) {
+    REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  }
+  // buffers are retired when the world is stopped
+  auto stats = get_stats(heap, &mutator);
+  REQUIRE(stats.n_blocks_used == 10);
+  REQUIRE(stats.bytes_used == 10 * (sizeof(Cell) + 8));
+  REQUIRE(stats.bytes_used + stats.bytes_free == 4096);
+  REQUIRE(stats.n_blocks_used + stats.n_blocks_free == stats.n_blocks_total);
+  mutator.collect();
+  stats = get_stats(heap, &mutator);
+  REQUIRE(stats.n_blocks_used == 0);
+  REQUIRE(stats.bytes_free == 4096);
+}
+
+TEST_CASE("shared heap - blocking region") {
+  gc::SharedHeap heap(16 * 1024, true, true, false, 512);
+  gc::SharedHeap::Mutator mutator(heap);
+  auto cell = reinterpret_cast<Cell *>(mutator.allocate(sizeof(Cell)));
+  REQUIRE(cell != nullptr);
+  cell->header = 42;
+  cell->next = nullptr;
+  mutator.push_root(reinterpret_cast<void **>(&cell));
+  // collections in the other thread must not wait for this one
+  mutator.enter_blocking();
+  std::atomic<size_t> errors = 0;
+  std::thread thread(build_lists, std::ref(heap), 1, 200, std::ref(errors),
+                     true);
+  thread.join();
+  mutator.leave_blocking();
+  REQUIRE(errors == 0);
+  REQUIRE(get_stats(heap, &mutator).collections > 0);
+  REQUIRE(cell->header == 42);
+  mutator.pop_root(reinterpret_cast<void **>(&cell));
+}
+
+TEST_CASE("shared heap - sizing policy") {
+  // GC time doesn't matter (it is dominated by logging in tests)
+  gc::SharedHeap heap(64 * 1024, true, true, false, 256, 4096,
+                      gc::HeapSizingOptions{.max_gc_fraction = 1.0});
+  gc::SharedHeap::Mutator mutator(heap);
+  // garbage only: collections are triggered long before the heap is full
+  for (size_t i = 0; i < 10000; i++) {
+    REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  }
+  size_t limit = 0;
+  auto stats = get_stats(heap, &mutator);
+  heap.stop_the_world(&mutator, [&](gc::MarkAndSweep &) {
+    limit = heap.heap_limit();
+  });
+  REQUIRE(stats.collections > 0);
+  REQUIRE(stats.bytes_used_max < 8 * 1024);
+  REQUIRE(limit < 64 * 1024);
+}
+
+TEST_CASE("shared heap - step") {
+  gc::SharedHeap heap(64 * 1024, true, true, true, 0);
+  gc::SharedHeap::Mutator mutator(heap);
+  Cell *live = nullptr;
+  mutator.push_root(reinterpret_cast<void **>(&live));
+  live = reinterpret_cast<Cell *>(mutator.allocate(sizeof(Cell)));
+  REQUIRE(live != nullptr);
+  live->header = 42;
+  live->next = nullptr;
+  for (size_t i = 0; i < 100; i++) {
+    REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  }
+  auto cycles = get_stats(heap, &mutator).incremental_collections;
+  // a small budget is not enough for the whole heap
+  REQUIRE(!mutator.step(16, gc::clock::time_point::max()));
+  REQUIRE(get_stats(heap, &mutator).incremental_collections == cycles);
+  // no budget: until the end of the cycle, but not further
+  REQUIRE(mutator.step(0, gc::clock::time_point::max()));
+  REQUIRE(get_stats(heap, &mutator).incremental_collections == cycles + 1);
+  // deadline already passed: one chunk of work
+  mutator.step(0, gc::clock::now());
+  REQUIRE(get_stats(heap, &mutator).incremental_collections <= cycles + 2);
+
+  mutator.collect();
+  auto stats = get_stats(heap, &mutator);
+  REQUIRE(stats.n_blocks_used == 1);
+  REQUIRE(stats.incremental_fallbacks == 0);
+  REQUIRE(live->header == 42);
+  mutator.pop_root(reinterpret_cast<void **>(&live));
+}
+
+TEST_CASE("shared heap - step without incremental mode") {
+  gc::SharedHeap heap(64 * 1024, true, true, false, 256, 4096);
+  gc::SharedHeap::Mutator mutator(heap);
+  // nothing to collect yet
+  REQUIRE(!mutator.step(0, gc::clock::time_point::max()));
+  REQUIRE(get_stats(heap, &mutator).collections == 0);
+  // the next buffer refill would collect, do it now instead
+  while (get_stats(heap, &mutator).bytes_used < 3 * 1024) {
+    REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  }
+  REQUIRE(get_stats(heap, &mutator).collections == 0);
+  REQUIRE(mutator.step(0, gc::clock::time_point::max()));
+  REQUIRE(get_stats(heap, &mutator).collections == 1);
+}
+
+TEST_CASE("shared heap - reservation") {
+  gc::SharedHeap heap(64 * 1024, true, true, false, 256, 4096);
+  gc::SharedHeap::Mutator mutator(heap);
+  // more than a buffer and than the sizing policy allows without collecting
+  const size_t count = 200;
+  REQUIRE(mutator.reserve(count, sizeof(Cell)));
+  auto collections = get_stats(heap, &mutator).collections;
+  REQUIRE(mutator.reserve(count, sizeof(Cell)));
+  auto block_size = gc::MarkAndSweep::block_size_for(sizeof(Cell), false);
+  Cell *list = nullptr;
+  for (size_t i = 0; i < count; i++) {
+    auto cell =
+        reinterpret_cast<Cell *>(mutator.allocate_reserved(sizeof(Cell)));
+    REQUIRE(cell != nullptr);
+    if (list) {
+      // consecutive
+      REQUIRE(reinterpret_cast<char *>(cell) ==
+              reinterpret_cast<char *>(list) + block_size);
+    }
+    cell->header = i;
+    cell->next = list;
+    list = cell;
+  }
+  mutator.push_root(reinterpret_cast<void **>(&list));
+  auto stats = get_stats(heap, &mutator);
+  REQUIRE(stats.collections == collections);
+  REQUIRE(stats.n_blocks_used == count);
+  size_t i = count;
+  for (auto p = list; p; p = p->next) {
+    REQUIRE(p->header == --i);
+  }
+  mutator.pop_root(reinterpret_cast<void **>(&list));
+
+  // more than the heap, not worth a collection
+  REQUIRE(!mutator.reserve(64 * 1024 / block_size + 1, sizeof(Cell)));
+  REQUIRE(get_stats(heap, &mutator).collections == collections);
+}
+
+TEST_CASE("shared heap - reservation in a fragmented heap") {
+  gc::SharedHeap heap(64 * 1024, true, true, false, 256);
+  gc::SharedHeap::Mutator mutator(heap);
+  // every other cell survives
+  Cell *list = nullptr;
+  mutator.push_root(reinterpret_cast<void **>(&list));
+  for (size_t i = 0;; i++) {
+    auto cell = reinterpret_cast<Cell *>(mutator.allocate(sizeof(Cell)));
+    if (!cell) {
+      break;
+    }
+    cell->header = i;
+    cell->next = nullptr;
+    if (i % 2 == 0) {
+      cell->next = list;
+      list = cell;
+    }
+  }
+  mutator.collect();
+  auto stats = get_stats(heap, &mutator);
+  REQUIRE(stats.bytes_free > 16 * 1024);
+  // free memory is there, but no block large enough
+  REQUIRE(!mutator.reserve(100, sizeof(Cell)));
+  REQUIRE(get_stats(heap, &mutator).collections == stats.collections);
+  REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  mutator.pop_root(reinterpret_cast<void **>(&list));
+}
+
+TEST_CASE("shared heap - no reservations in incremental mode") {
+  gc::SharedHeap heap(64 * 1024, true, true, true, 0);
+  gc::SharedHeap::Mutator mutator(heap);
+  REQUIRE(!mutator.reserve(1, sizeof(Cell)));
+  REQUIRE(mutator.allocate_reserved(sizeof(Cell)) == nullptr);
+  REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+}
+
+TEST_CASE("shared heap - conservative roots") {
+  gc::SharedHeap heap(16 * 1024, true, true, false, 512);
+  heap.enable_conservative_roots();
+  run_threads(heap, 4, 200, false);
+  auto stats = get_stats(heap);
+  REQUIRE(stats.collections > 0);
+  REQUIRE(stats.reads == 4 * 200 * 10);
+
+  // held in a blocking region while another thread collects
+  gc::SharedHeap::Mutator mutator(heap);
+  auto cell = reinterpret_cast<Cell *>(mutator.allocate(sizeof(Cell)));
+  REQUIRE(cell != nullptr);
+  cell->header = 42;
+  cell->next = nullptr;
+  mutator.enter_blocking();
+  std::atomic<size_t> errors = 0;
+  std::thread thread(build_lists, std::ref(heap), 1, 200, std::ref(errors),
+                     false);
+  thread.join();
+  mutator.leave_blocking();
+  REQUIRE(errors == 0);
+  REQUIRE(get_stats(heap, &mutator).collections > stats.collections);
+  REQUIRE(cell->header == 42);
+}
+
+TEST_CASE("shared heap - published stats") {
+  gc::SharedHeap heap(16 * 1024, true, true, false, 512);
+  gc::SharedHeap::Mutator mutator(heap);
+  heap.stop_the_world(&mutator, [](gc::MarkAndSweep &collector) {
+    collector.set_census(true);
+  });
+  REQUIRE(mutator.allocate(sizeof(Cell)) != nullptr);
+  mutator.collect();
+  // read while this thread's mutator is running (not at a safepoint)
+  size_t collections = 0;
+  std::thread reader(
+      [&] { collections = heap.published_stats().stats.collections; });
+  reader.join();
+  REQUIRE(collections == 1);
+  REQUIRE(heap.published_census().collection == 1);
+}
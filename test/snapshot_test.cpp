@@ -0,0 +1,292 @@
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <mark_and_sweep.hpp>
+#include <memory>
+#include <snapshot.hpp>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Cell {
+  size_t header;
+  Cell *next;
+};
+
+gc::Snapshot load(const std::string &data) {
+  return gc::Snapshot({reinterpret_cast<const unsigned char *>(data.data()),
+                       data.size()});
+}
+
+// `data` in a temporary file (removed when closed)
+std::unique_ptr<std::FILE, int (*)(std::FILE *)>
+temp_file(const std::string &data) {
+  std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::tmpfile(),
+                                                       std::fclose);
+  REQUIRE(file);
+  std::fwrite(data.data(), 1, data.size(), file.get());
+  std::fflush(file.get());
+  return file;
+}
+
+// list of `n` cells (tag 11, merged headers) ending with `last`
+Cell *build_list(gc::MarkAndSweep &collector, size_t n, Cell *last) {
+  Cell *list = last;
+  for (size_t i = 0; i < n; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    *reinterpret_cast<uint8_t *>(&cell->header) = 11 | (1 << 4);
+    cell->next = list;
+    list = cell;
+  }
+  return list;
+}
+
+size_t list_length(Cell *list, Cell *last) {
+  size_t n = 0;
+  for (; list != last; list = list->next) {
+    REQUIRE((list->header & 0xff) == (11 | (1 << 4)));
+    n++;
+  }
+  return n;
+}
+
+TEST_CASE("snapshot - empty heap") {
+  gc::MarkAndSweep collector(256, true, true, false);
+  std::ostringstream out;
+  collector.write_snapshot(out);
+  auto data = out.str();
+  auto snapshot = load(data);
+  auto &header = snapshot.header();
+  REQUIRE(header.space_size == 256);
+  REQUIRE(header.space_offset % gc::SnapshotHeader::space_alignment == 0);
+  REQUIRE(data.size() == header.space_offset + header.space_size);
+  REQUIRE(snapshot.roots().empty());
+  REQUIRE(snapshot.freelist().size() == 1);
+  auto summary = snapshot.summary();
+  REQUIRE(summary.n_blocks_used == 0);
+  REQUIRE(summary.n_blocks_free == 1);
+  REQUIRE(summary.bytes_free == 256);
+  REQUIRE(summary.largest_free_block == 256);
+}
+
+TEST_CASE("snapshot - reachability and types") {
+  gc::MarkAndSweep collector(1024, true, true, false);
+  // list of 3 cells (tag 11) and 2 unreachable cells (tag 1)
+  Cell *list = nullptr;
+  for (size_t i = 0; i < 3; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    cell->header = 11 | (1 << 4);
+    cell->next = list;
+    list = cell;
+  }
+  for (size_t i = 0; i < 2; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    cell->header = 1 | (1 << 4);
+    cell->next = list;
+  }
+  collector.push_root(reinterpret_cast<void **>(&list));
+  std::ostringstream out;
+  collector.write_snapshot(out);
+  auto data = out.str();
+  auto snapshot = load(data);
+  REQUIRE(snapshot.roots().size() == 1);
+  REQUIRE(snapshot.roots()[0].value == reinterpret_cast<uintptr_t>(list));
+  auto summary = snapshot.summary();
+  REQUIRE(summary.n_blocks_used == 5);
+  REQUIRE(summary.n_reachable == 3);
+  REQUIRE(summary.bytes_reachable == 3 * 24);
+  REQUIRE(summary.bytes_used + summary.bytes_free == 1024);
+  auto types = snapshot.type_stats();
+  REQUIRE(types.size() == 1);
+  REQUIRE(types.at(11).objects == 3);
+  REQUIRE(types.at(11).bytes == 3 * 24);
+  auto sizes = snapshot.size_stats();
+  REQUIRE(sizes.size() == 1);
+  REQUIRE(sizes.at(24).objects == 5);
+}
+
+TEST_CASE("snapshot - invalid data") {
+  REQUIRE_THROWS(load("not a snapshot"));
+  gc::MarkAndSweep collector(256, true, true, false);
+  std::ostringstream out;
+  collector.write_snapshot(out);
+  auto data = out.str();
+  REQUIRE_THROWS(load(data.substr(0, data.size() - 1)));
+}
+
+TEST_CASE("snapshot - merged headers") {
+  gc::MarkAndSweep collector(1024, true, false, false, gc::HugePages::NONE,
+                             true);
+  // same list as above, headers are only the lowest byte of the first word
+  Cell *list = nullptr;
+  for (size_t i = 0; i < 3; i++) {
+    auto cell = reinterpret_cast<Cell *>(collector.allocate(sizeof(Cell)));
+    *reinterpret_cast<uint8_t *>(&cell->header) = 11 | (1 << 4);
+    cell->next = list;
+    list = cell;
+  }
+  collector.push_root(reinterpret_cast<void **>(&list));
+  std::ostringstream out;
+  collector.write_snapshot(out);
+  auto data = out.str();
+  auto snapshot = load(data);
+  bool merged =
+      snapshot.header().flags & gc::SnapshotHeader::FLAG_MERGED_HEADER;
+  REQUIRE(merged);
+  auto summary = snapshot.summary();
+  REQUIRE(summary.n_reachable == 3);
+  REQUIRE(summary.bytes_reachable == 3 * 16);
+  auto types = snapshot.type_stats();
+  REQUIRE(types.size() == 1);
+  REQUIRE(types.at(11).objects == 3);
+}
+
+TEST_CASE("snapshot - compressed refs") {
+  struct Cons {
+    size_t header;
+    gc::MarkAndSweep::ref_t head;
+    gc::MarkAndSweep::ref_t tail;
+  };
+  gc::MarkAndSweep collector(1024, true, false, false, gc::HugePages::NONE,
+                             true, true);
+  Cons *list = nullptr;
+  for (size_t i = 0; i < 3; i++) {
+    auto cell = reinterpret_cast<Cons *>(collector.allocate(sizeof(Cons)));
+    *reinterpret_cast<uint8_t *>(&cell->header) = 11 | (2 << 4);
+    cell->head = collector.compress(list);
+    cell->tail = collector.compress(list);
+    list = cell;
+  }
+  // external references are not followed
+  list->head = gc::MarkAndSweep::external_ref_bit | 1;
+  collector.push_root(reinterpret_cast<void **>(&list));
+  std::ostringstream out;
+  collector.write_snapshot(out);
+  auto data = out.str();
+  auto snapshot = load(data);
+  bool compressed =
+      snapshot.header().flags & gc::SnapshotHeader::FLAG_COMPRESSED_REFS;
+  REQUIRE(compressed);
+  auto x = reinterpret_cast<uint64_t>(list) + sizeof(uint64_t);
+  REQUIRE(snapshot.field_count(x) == 2);
+  REQUIRE(snapshot.field(x, 0) == 0);
+  auto summary = snapshot.summary();
+  REQUIRE(summary.n_reachable == 3);
+  REQUIRE(summary.bytes_reachable == 3 * 16);
+}
+
+TEST_CASE("image - relocated") {
+  // a static object the last cell points to, "moved" by 16 bytes
+  Cell statics[3] = {};
+  auto written = std::make_unique<gc::MarkAndSweep>(
+      4096, true, false, false, gc::HugePages::NONE, true);
+  auto list = build_list(*written, 3, &statics[0]);
+  // garbage is kept too, the image ends with the last used block
+  build_list(*written, 2, nullptr);
+  std::ostringstream out;
+  written->write_image(out, {list}, &statics[0], {&statics[0], &statics[3]});
+  auto data = out.str();
+  auto image = load(data);
+  bool is_image = image.header().flags & gc::SnapshotHeader::FLAG_IMAGE;
+  REQUIRE(is_image);
+  REQUIRE(image.header().space_size == 5 * 16);
+  REQUIRE(image.roots().size() == 1);
+  REQUIRE(image.summary().n_reachable == 3);
+
+  // the written heap still takes its address range
+  gc::MarkAndSweep loaded(8192, true, false, false, gc::HugePages::NONE,
+                          true);
+  auto file = temp_file(data);
+  auto roots = loaded.load_image(fileno(file.get()), &statics[2]);
+  REQUIRE(roots.size() == 1);
+  auto root = static_cast<Cell *>(roots[0]);
+  REQUIRE(root != list);
+  REQUIRE(loaded.contains(root));
+  REQUIRE(list_length(root, &statics[2]) == 3);
+  auto stats = loaded.get_stats();
+  REQUIRE(stats.n_blocks_used == 5);
+  REQUIRE(stats.bytes_used == 5 * 16);
+  REQUIRE(stats.bytes_used + stats.bytes_free == 8192);
+
+  // garbage of the image is collected, new objects go after the image
+  loaded.push_root(reinterpret_cast<void **>(&root));
+  loaded.collect();
+  REQUIRE(loaded.get_stats().n_blocks_used == 3);
+  root = build_list(loaded, 100, root);
+  loaded.collect();
+  REQUIRE(list_length(root, &statics[2]) == 103);
+  REQUIRE(loaded.get_stats().n_blocks_used == 103);
+}
+
+TEST_CASE("image - same address") {
+  Cell statics[1] = {};
+  auto written = std::make_unique<gc::MarkAndSweep>(
+      4096, true, false, false, gc::HugePages::NONE, true);
+  auto list = build_list(*written, 3, &statics[0]);
+  std::ostringstream out;
+  written->write_image(out, {list, nullptr}, &statics[0],
+                        {&statics[0], &statics[1]});
+  auto address = reinterpret_cast<uintptr_t>(list);
+  gc::MarkAndSweep loaded(4096, true, false, false, gc::HugePages::NONE,
+                          true);
+  written.reset();
+
+  // the heap is moved into the freed address range, nothing is rewritten
+  auto file = temp_file(out.str());
+  auto roots = loaded.load_image(fileno(file.get()), &statics[0]);
+  REQUIRE(roots.size() == 2);
+  REQUIRE(reinterpret_cast<uintptr_t>(roots[0]) == address);
+  REQUIRE(roots[1] == nullptr);
+  REQUIRE(list_length(static_cast<Cell *>(roots[0]), &statics[0]) == 3);
+  REQUIRE(loaded.get_stats().n_blocks_used == 3);
+  loaded.push_root(&roots[0]);
+  loaded.collect();
+  REQUIRE(loaded.get_stats().n_blocks_used == 3);
+}
+
+TEST_CASE("image - invalid images leave the heap empty") {
+  gc::MarkAndSweep written(4096, true, false, false, gc::HugePages::NONE,
+                           true);
+  auto list = build_list(written, 3, nullptr);
+  std::ostringstream snapshot_out;
+  written.write_snapshot(snapshot_out);
+  std::ostringstream image_out;
+  written.write_image(image_out, {list});
+  auto image = image_out.str();
+
+  gc::MarkAndSweep loaded(4096, true, false, false, gc::HugePages::NONE,
+                          true);
+  auto load_from = [&](const std::string &data) {
+    auto file = temp_file(data);
+    return loaded.load_image(fileno(file.get()));
+  };
+  REQUIRE_THROWS(load_from("not an image"));
+  REQUIRE_THROWS(load_from(snapshot_out.str()));
+  // block sizes are checked while loading
+  auto corrupted = image;
+  auto space_offset = load(image).header().space_offset;
+  corrupted[space_offset + 16 + 4] = 3;
+  REQUIRE_THROWS(load_from(corrupted));
+  REQUIRE(loaded.get_stats().n_blocks_used == 0);
+  REQUIRE(loaded.get_stats().bytes_free == 4096);
+  // different object layout, too large
+  gc::MarkAndSweep separate(4096, true, true, false);
+  auto file = temp_file(image);
+  REQUIRE_THROWS(separate.load_image(fileno(file.get())));
+  gc::MarkAndSweep small(32, true, false, false, gc::HugePages::NONE, true);
+  REQUIRE_THROWS(small.load_image(fileno(file.get())));
+
+  // rewritten pointers must point into the image or its external range
+  Cell outside = {};
+  gc::MarkAndSweep escaping(4096, true, false, false, gc::HugePages::NONE,
+                            true);
+  std::ostringstream escaping_out;
+  escaping.write_image(escaping_out, {build_list(escaping, 2, &outside)});
+  REQUIRE_THROWS(load_from(escaping_out.str()));
+  REQUIRE(loaded.get_stats().n_blocks_used == 0);
+  REQUIRE(loaded.get_stats().bytes_free == 4096);
+
+  // an empty heap takes a valid image
+  auto roots = load_from(image);
+  REQUIRE(list_length(static_cast<Cell *>(roots[0]), nullptr) == 3);
+  REQUIRE_THROWS(load_from(image));
+}
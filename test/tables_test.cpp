@@ -1,4 +1,5 @@
 #include <catch2/catch_test_macros.hpp>
+#include <sstream>
 #include <tables.hpp>
 
 TEST_CASE("tables") {
@@ -18,3 +19,29 @@ TEST_CASE("tables") {
       "+-------+--------+---------+";
   REQUIRE(t.to_string() == expected);
 }
+
+TEST_CASE("tables - stream") {
+  std::ostringstream out;
+  tables::Table t({3, 4}, out);
+  t.separator();
+  t.add_row({"A", "BCDEFG"});
+  t.separator();
+  auto expected =
+      "+-----+------+\n"
+      "| A   | BCDE |\n"
+      "+-----+------+";
+  REQUIRE(out.str() == expected);
+}
+
+TEST_CASE("tables - file stream") {
+  auto file = std::tmpfile();
+  REQUIRE(file != nullptr);
+  {
+    tables::FileStream out(file);
+    for (size_t i = 0; i < 100000; i++) {
+      out << "0123456789";
+    }
+  }
+  REQUIRE(std::ftell(file) == 1000000);
+  std::fclose(file);
+}
@@ -0,0 +1,112 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#include "runtime.h"
+#include "snapshot.hpp"
+#include "tables.hpp"
+
+void print_summary(const gc::Snapshot &snapshot) {
+  auto &header = snapshot.header();
+  auto summary = snapshot.summary();
+  std::cout << "SUMMARY\n";
+  tables::Table table({26, 16, 17});
+  table.separator();
+  table.add_row({"HEAP", std::format("{:10} bytes", header.space_size),
+                 std::format("{:#17x}", header.space_start)});
+  table.add_row({"COLLECTIONS (full / incr)",
+                 std::format("{:9} cycles", header.collections),
+                 std::format("{:10} cycles", header.incremental_collections)});
+  table.separator();
+  table.add_row({"MEMORY USED", std::format("{:10} bytes", summary.bytes_used),
+                 std::format("{:10} blocks", summary.n_blocks_used)});
+  table.add_row({"MEMORY REACHABLE",
+                 std::format("{:10} bytes", summary.bytes_reachable),
+                 std::format("{:10} blocks", summary.n_reachable)});
+  table.add_row({"MEMORY UNREACHABLE",
+                 std::format("{:10} bytes",
+                             summary.bytes_used - summary.bytes_reachable),
+                 std::format("{:10} blocks",
+                             summary.n_blocks_used - summary.n_reachable)});
+  table.add_row({"MEMORY FREE", std::format("{:10} bytes", summary.bytes_free),
+                 std::format("{:10} blocks", summary.n_blocks_free)});
+  table.add_row({"LARGEST FREE BLOCK",
+                 std::format("{:10} bytes", summary.largest_free_block), ""});
+  table.add_row({"FREELIST", "",
+                 std::format("{:10} blocks", snapshot.freelist().size())});
+  table.add_row({"ROOTS", "",
+                 std::format("{:10} roots", snapshot.roots().size())});
+  table.separator();
+  std::cout << table.to_string() << "\n\n";
+}
+
+void print_types(const gc::Snapshot &snapshot) {
+  std::cout << "REACHABLE OBJECTS BY TAG\n";
+  tables::Table table({26, 16, 17});
+  table.separator();
+  table.add_row({"TAG", "BYTES", "OBJECTS"});
+  table.separator();
+  for (auto &[tag, stats] : snapshot.type_stats()) {
+    table.add_row({stella_tag_name(static_cast<enum TAG>(tag)),
+                   std::format("{:10} bytes", stats.bytes),
+                   std::format("{:9} objects", stats.objects)});
+  }
+  table.separator();
+  std::cout << table.to_string() << "\n\n";
+}
+
+void print_sizes(const gc::Snapshot &snapshot) {
+  std::cout << "USED BLOCKS BY SIZE\n";
+  tables::Table table({26, 16, 17});
+  table.separator();
+  table.add_row({"BLOCK SIZE", "BYTES", "BLOCKS"});
+  table.separator();
+  for (auto &[size, stats] : snapshot.size_stats()) {
+    table.add_row({std::format("{:10} bytes", size),
+                   std::format("{:10} bytes", stats.bytes),
+                   std::format("{:10} blocks", stats.objects)});
+  }
+  table.separator();
+  std::cout << table.to_string() << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "usage: " << argv[0] << " SNAPSHOT" << std::endl;
+    return 2;
+  }
+  auto fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    std::perror(argv[1]);
+    return 1;
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::perror("mmap");
+    return 1;
+  }
+  try {
+    gc::Snapshot snapshot(
+        {reinterpret_cast<const unsigned char *>(data), size});
+    print_summary(snapshot);
+    // Stella headers are only known if the first field is one
+    if (snapshot.header().flags & (gc::SnapshotHeader::FLAG_SKIP_FIRST_FIELD |
+                                   gc::SnapshotHeader::FLAG_MERGED_HEADER)) {
+      print_types(snapshot);
+    }
+    print_sizes(snapshot);
+  } catch (const std::runtime_error &e) {
+    std::cerr << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+  munmap(data, size);
+  return 0;
+}